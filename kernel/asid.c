@@ -0,0 +1,122 @@
+// Address-space identifiers.
+//
+// Each user page table gets an ASID, which satp carries along
+// with the page table's address. TLB entries are tagged with
+// it, so switching between the kernel page table (ASID 0) and
+// a user one on every trap does not have to flush the TLB.
+//
+// ASIDs are handed out in increasing order. When they run out,
+// the generation goes up and numbering starts over: every
+// process then gets a new ASID the next time it returns to user
+// space, and every hart flushes its whole TLB before using an
+// ASID of the new generation.
+//
+// A process's own entries still have to be flushed when the
+// kernel changes its page table; asidstale() marks them stale
+// on every hart, and asidsatp() flushes them on the hart that
+// next runs the process.
+//
+// Harts without ASIDs keep flushing the whole TLB on every
+// switch to and from user space, in trampoline.S.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  uint64 max;    // largest ASID the hardware keeps, 0 if none
+  uint64 gen;    // current generation
+  uint64 next;   // next free ASID in this generation
+} asid;
+
+// Find out how many ASID bits satp keeps.
+// Called on the boot hart, after paging is on.
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asid.lock, "asid");
+  w_satp(satp | SATP_ASIDMASK);
+  asid.max = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
+  w_satp(satp);
+  sfence_vma();
+
+  asid.gen = 1;
+  asid.next = 1;   // ASID 0 is the kernel's
+}
+
+// Give p a fresh ASID for a new page table.
+// Caller must hold asid.lock.
+static void
+asidalloc_locked(struct proc *p)
+{
+  if(asid.next > asid.max){
+    asid.gen++;
+    asid.next = 1;
+  }
+  p->asid = asid.next++;
+  p->asidgen = asid.gen;
+  p->tlbstale = 0;
+}
+
+// Give p a fresh ASID, for the page table that
+// proc_pagetable() is making for it.
+void
+asidalloc(struct proc *p)
+{
+  if(asid.max == 0)
+    return;
+  acquire(&asid.lock);
+  asidalloc_locked(p);
+  release(&asid.lock);
+}
+
+// The calling process changed PTEs in pagetable; if that is its
+// own page table, entries cached for it on any hart are stale.
+void
+asidstale(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p != 0 && p->pagetable == pagetable)
+    p->tlbstale = ~0;
+}
+
+// Return the satp value for running p in user space on this
+// hart, flushing whatever TLB entries it must not see.
+// Called with interrupts off.
+uint64
+asidsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint bit = 1 << cpuid();
+
+  if(asid.max == 0)
+    return MAKE_SATP(p->pagetable, 0);
+
+  if(p->asidgen != __atomic_load_n(&asid.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asid.lock);
+    if(p->asidgen != asid.gen)
+      asidalloc_locked(p);
+    release(&asid.lock);
+  }
+
+  if(c->asidgen != p->asidgen){
+    // First ASID of a new generation on this hart; entries
+    // left from the old one may carry the same numbers
+    sfence_vma();
+    c->asidgen = p->asidgen;
+    p->tlbstale &= ~bit;
+  } else if(p->tlbstale & bit){
+    sfence_vma_asid(p->asid);
+    p->tlbstale &= ~bit;
+  }
+
+  return MAKE_SATP(p->pagetable, p->asid);
+}
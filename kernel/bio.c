@@ -236,6 +236,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it, for a caller that overwrites all of it and then calls
+// bwrite().
+struct buf*
+bgetblk(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -0,0 +1,201 @@
+// Buddy allocator for physically contiguous memory.
+//
+// Manages the physical pages from BUDDYBASE to PHYSTOP as
+// blocks of 2^order pages, for order 0 to BUDDY_MAXORDER.
+// kalloc() keeps handing out single pages from its own
+// freelists and only falls back on this region when they
+// run dry; pages from this region always come back here.
+//
+// Interface:
+// * kalloc_pages(order) returns 2^order contiguous pages,
+//     aligned to their own size.
+// * kfree_pages(pa, order) frees them again, merging the
+//     block with its buddy for as long as the buddy is free.
+// * A block may be freed in smaller pieces than it was
+//     allocated in; the pieces merge back as they come in.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "page.h"
+
+#define BUDDY_NPAGES ((PHYSTOP - BUDDYBASE) / PGSIZE)
+#define BLOCK_INDEX(pa) (((uint64)(pa) - BUDDYBASE) / PGSIZE)
+#define BLOCK_ADDR(i)   ((void *)(BUDDYBASE + (uint64)(i) * PGSIZE))
+#define BUDDY_NONE      (-1)    // buddy.order[i]: no free block starts here
+
+// Lives in the first page of every free block.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block free[BUDDY_MAXORDER+1];  // Circular list heads, one per order
+  int nfree[BUDDY_MAXORDER+1];          // Number of free blocks per order
+  signed char order[BUDDY_NPAGES];      // Order of the free block starting
+                                        // at this page, or BUDDY_NONE
+} buddy;
+
+static void
+block_insert(int i, int order)
+{
+  struct block *b = BLOCK_ADDR(i);
+  struct block *head = &buddy.free[order];
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  buddy.order[i] = order;
+  buddy.nfree[order]++;
+}
+
+static void
+block_remove(int i)
+{
+  struct block *b = BLOCK_ADDR(i);
+
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.nfree[(int)buddy.order[i]]--;
+  buddy.order[i] = BUDDY_NONE;
+}
+
+void
+buddyinit(void)
+{
+  initlock(&buddy.lock, "buddy");
+
+  for (int k = 0; k <= BUDDY_MAXORDER; k++) {
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+    buddy.nfree[k] = 0;
+  }
+  memset(buddy.order, BUDDY_NONE, sizeof(buddy.order));
+
+  // The region is aligned to the largest block size,
+  // so it splits evenly into maximum-order blocks
+  for (int i = 0; i < BUDDY_NPAGES; i += (1 << BUDDY_MAXORDER))
+    block_insert(i, BUDDY_MAXORDER);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// (2^order)*PGSIZE bytes.
+// Returns 0 if no block that large is available.
+void *
+kalloc_pages(int order)
+{
+  int k, i;
+
+  if (order < 0 || order > BUDDY_MAXORDER)
+    return 0;
+
+  acquire(&buddy.lock);
+
+  // Smallest free block that is large enough
+  for (k = order; k <= BUDDY_MAXORDER; k++)
+    if (buddy.nfree[k] > 0)
+      break;
+  if (k > BUDDY_MAXORDER) {
+    release(&buddy.lock);
+    return 0;
+  }
+
+  i = BLOCK_INDEX(buddy.free[k].next);
+  block_remove(i);
+
+  // Split it, keeping the lower half and freeing the upper one
+  while (k > order) {
+    k--;
+    block_insert(i + (1 << k), k);
+  }
+
+  release(&buddy.lock);
+
+  for (int j = 0; j < (1 << order); j++)
+    mem_initref((uint64)BLOCK_ADDR(i + j));
+
+  memset(BLOCK_ADDR(i), 5, PGSIZE << order); // fill with junk
+  return BLOCK_ADDR(i);
+}
+
+// Free 2^order pages starting at pa, which normally should
+// have been returned by kalloc_pages().
+void
+kfree_pages(void *pa, int order)
+{
+  int i, b;
+
+  if ((uint64)pa < BUDDYBASE || (uint64)pa >= PHYSTOP ||
+      order < 0 || order > BUDDY_MAXORDER)
+    panic("kfree_pages");
+
+  i = BLOCK_INDEX(pa);
+  if ((i & ((1 << order) - 1)) != 0)
+    panic("kfree_pages: not aligned");
+
+  for (int j = 0; j < (1 << order); j++)
+    PA2PAGE(BLOCK_ADDR(i + j))->refcnt = 0;
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+
+  acquire(&buddy.lock);
+
+  if (buddy.order[i] != BUDDY_NONE)
+    panic("kfree_pages: double free");
+
+  // Merge with the buddy for as long as it is a free block
+  // of the same order
+  while (order < BUDDY_MAXORDER) {
+    b = i ^ (1 << order);
+    if (buddy.order[b] != order)
+      break;
+    block_remove(b);
+    if (b < i)
+      i = b;
+    order++;
+  }
+  block_insert(i, order);
+
+  release(&buddy.lock);
+}
+
+// Number of free blocks of the given order.
+int
+buddy_nfree(int order)
+{
+  if (order < 0 || order > BUDDY_MAXORDER)
+    return 0;
+  return buddy.nfree[order];
+}
+
+// Number of free pages across all orders.
+uint64
+buddy_freepages(void)
+{
+  uint64 n = 0;
+
+  for (int k = 0; k <= BUDDY_MAXORDER; k++)
+    n += (uint64)buddy.nfree[k] << k;
+  return n;
+}
+
+#ifdef LAB_LOCK
+int
+statsbuddy(char *buf, int sz)
+{
+  int n;
+
+  acquire(&buddy.lock);
+  n = snprintf(buf, sz, "--- buddy free blocks\n");
+  for (int k = 0; k <= BUDDY_MAXORDER; k++)
+    n += snprintf(buf+n, sz-n, "order %d: %d\n", k, buddy.nfree[k]);
+  release(&buddy.lock);
+  return n;
+}
+#endif
@@ -80,7 +80,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -109,8 +109,17 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      // keep the byte; dst may just be swapped out or not
+      // touched yet, and bringing it in takes the disk.
+      cons.r--;
+      release(&cons.lock);
+      r = user_dst ? uvmfaultin(myproc()->pagetable, dst, 1) : -1;
+      acquire(&cons.lock);
+      if(r < 0)
+        break;
+      continue;
+    }
 
     dst++;
     --n;
@@ -6,6 +6,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -17,14 +18,31 @@ struct mbuf;
 struct sock;
 #endif
 
+// asid.c
+void            asidinit(void);
+void            asidalloc(struct proc*);
+void            asidstale(pagetable_t);
+uint64          asidsatp(struct proc*);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetblk(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// buddy.c
+void            buddyinit(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+int             buddy_nfree(int);
+uint64          buddy_freepages(void);
+#ifdef LAB_LOCK
+int             statsbuddy(char*, int);
+#endif
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
@@ -32,6 +50,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -42,8 +61,6 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 #ifdef LAB_MMAP
-int             filemmap(uint64 va);
-int             filemunmap(int i);
 #endif
 
 // fs.c
@@ -73,15 +90,16 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
 void            kinit(void);
-#ifdef LAB_SYSCALL
+void            kzeroinit(void);
+uint64          mem_freepages(int);
 uint64          mem_freebytes(void);
-#endif
-#ifdef LAB_COW
-void            mem_addref(uint64 va);
-int             mem_dropref(uint64 va);
-#endif
+void            mem_initref(uint64 pa);
+void            mem_addref(uint64 pa);
+int             mem_dropref(uint64 pa);
+int             mem_getref(uint64 pa);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -90,6 +108,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -105,7 +124,9 @@ void            backtrace(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
+int             kthread_create(char*, void (*)(void));
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -115,6 +136,7 @@ uint64          proc_countactive(void);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
+int             procquiet(struct proc*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -136,6 +158,7 @@ void            swtch(struct context*, struct context*);
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             maysleep(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
@@ -145,6 +168,19 @@ int             atomic_read4(int *addr);
 void            freelock(struct spinlock*);
 #endif
 
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+uint64          shmattach(int);
+int             shmdetach(uint64);
+int             shmfork(struct proc*, struct proc*);
+void            shmexit(struct proc*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -160,6 +196,16 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+int             swapout(void);
+int             swapin(pagetable_t, uint64);
+int             swapinrange(pagetable_t, uint64, uint64);
+void            swapdup(uint);
+void            swapput(uint);
+int             swapnfree(void);
+void*           kalloc_reclaim(int);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -199,11 +245,27 @@ void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
+pte_t *         walkleaf(pagetable_t, uint64, int*);
+int             mapleaves(pagetable_t, uint64, uint64, uint64, int, int);
+int             uvmsplit(pagetable_t, uint64);
+#ifdef LAB_COW
+int             uvmunshare(pagetable_t, uint64);
+uint64          uvmunzero(pagetable_t, uint64);
+#endif
+#if defined(LAB_LAZY) || defined(LAB_MMAP)
+int             uvmlazy(pagetable_t, uint64);
+#endif
 uint64          walkaddr(pagetable_t, uint64);
+int             uvmfaultin(pagetable_t, uint64, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 void            vmprint(pagetable_t);
+#ifdef LAB_PGTBL
+void            uvmscan(pagetable_t, uint64, int, uchar *, uchar *);
+void            uvmsample(pagetable_t, uint64, uint64 *, uint64 *);
+#endif
 
 // plic.c
 void            plicinit(void);
@@ -225,7 +287,45 @@ int             copyin_new(pagetable_t, char *, uint64, uint64);
 int             copyinstr_new(pagetable_t, char *, uint64, uint64);
 #endif
 
-#ifdef LAB_LOCK
+#ifdef LAB_PGTBL
+// wset.c
+struct wsinfo;
+void            wsetinit(void);
+void            wssample(struct proc*);
+int             wsget(int, struct wsinfo*);
+#endif
+
+#ifdef LAB_MMAP
+// pcache.c
+void            pcacheinit(void);
+uint64          pcachelookup(struct inode*, uint);
+uint64          pcacheget(struct inode*, uint);
+void            pcacheupdate(struct inode*, uint, char*, uint);
+void            pcacheevict(struct inode*);
+void            pcachetext(uint64);
+int             pcacheshrink(void);
+void            pcachereadahead(struct inode*, uint, int);
+int             statspcache(char*, int);
+
+// vma.c
+uint64          vmamap(uint64, int, int, struct file*, uint64);
+int             vmaimage(struct proc*, uint64, uint64, int, struct file*, uint64);
+int             vmaunmap(uint64, uint64);
+int             vmamsync(uint64, uint64, int);
+int             vmamadvise(uint64, uint64, int);
+int             vmafault(pagetable_t, uint64);
+int             vmafork(struct proc*, struct proc*);
+void            vmaexit(struct proc*);
+int             statsvma(char*, int);
+#endif
+
+#ifdef LAB_COW
+// merge.c
+void            mergeinit(void);
+int             statsmerge(char*, int);
+#endif
+
+#if defined(LAB_LOCK) || defined(LAB_COW) || defined(LAB_MMAP)
 // stats.c
 void            statsinit(void);
 void            statsinc(void);
@@ -248,6 +348,7 @@ void            e1000_intr(void);
 int             e1000_transmit(struct mbuf*);
 
 // net.c
+void            mbufinit(void);
 void            net_rx(struct mbuf*);
 void            net_tx_udp(struct mbuf*, uint32, uint16, uint16);
 
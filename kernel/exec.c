@@ -6,6 +6,20 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#ifdef LAB_MMAP
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define NLAZY 4   // segments read in as they are touched, at most
+
+struct lazyseg {
+  uint64 start, end;
+  int prot;
+  uint64 off;
+};
+#endif
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -21,6 +35,15 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace p's user memory with the program at path, started
+// with argv. exec() does this to the calling process, spawn()
+// to a process it has just allocated.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -29,7 +52,11 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+#ifdef LAB_MMAP
+  struct file *f = 0;
+  struct lazyseg lazy[NLAZY];
+  int nlazy = 0;
+#endif
 
   begin_op();
 
@@ -49,6 +76,18 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
+#ifdef LAB_MMAP
+  // An open file for the ranges that vmafault() reads the
+  // program in through; without one, it is all read now.
+  if((f = filealloc()) != 0){
+    f->type = FD_INODE;
+    f->ip = idup(ip);
+    f->readable = 1;
+    f->writable = 0;
+    f->off = 0;
+  }
+#endif
+
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -61,18 +100,39 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
+    uint64 sz1, skip = 0;
+#ifdef LAB_MMAP
+    // Leave the whole pages of file data to be read in when
+    // first touched; the last, partly file and partly zeros,
+    // and the zeros after it are allocated now.
+    if(f && nlazy < NLAZY && ph.off % PGSIZE == 0 &&
+       (skip = PGROUNDDOWN(ph.filesz)) > 0){
+      if(sz < ph.vaddr && uvmalloc(pagetable, sz, ph.vaddr, flags2perm(ph.flags)) == 0)
+        goto bad;
+      lazy[nlazy].start = ph.vaddr;
+      lazy[nlazy].end = ph.vaddr + skip;
+      lazy[nlazy].prot = PROT_READ;
+      if(ph.flags & ELF_PROG_FLAG_EXEC)
+        lazy[nlazy].prot |= PROT_EXEC;
+      if(ph.flags & ELF_PROG_FLAG_WRITE)
+        lazy[nlazy].prot |= PROT_WRITE;
+      lazy[nlazy].off = ph.off;
+      nlazy++;
+      // No writes to the file from now on; see vmaimage()
+      __sync_fetch_and_add(&ip->ntext, 1);
+      sz = ph.vaddr + skip;
+    }
+#endif
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
     sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(loadseg(pagetable, ph.vaddr + skip, ip, ph.off + skip, ph.filesz - skip) < 0)
       goto bad;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -83,6 +143,12 @@ exec(char *path, char **argv)
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
+#ifdef LAB_COW
+  // copyout() below cannot take write faults on behalf of
+  // a page table that is not the current process's yet
+  if(uvmunzero(pagetable, sz-PGSIZE) == 0)
+    goto bad;
+#endif
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
@@ -120,7 +186,16 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
 
-  // Commit to the user image.
+  // Commit to the user image, which has no shared
+  // memory segments attached, nor files mapped.
+  shmexit(p);
+#ifdef LAB_MMAP
+  vmaexit(p);
+  for(i = 0; i < nlazy; i++)
+    vmaimage(p, lazy[i].start, lazy[i].end, lazy[i].prot, f, lazy[i].off);
+  if(f)
+    fileclose(f);   // the ranges hold their own references
+#endif
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
@@ -141,6 +216,13 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+#ifdef LAB_MMAP
+  // Outside the transaction, since it may end one of its own
+  if(f){
+    __sync_fetch_and_add(&f->ip->ntext, -nlazy);
+    fileclose(f);
+  }
+#endif
   return -1;
 }
 
@@ -155,9 +237,15 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   uint64 pa;
 
   for(i = 0; i < sz; i += PGSIZE){
+#ifdef LAB_COW
+    // Writable segments map the zero page until written
+    if((pa = uvmunzero(pagetable, va + i)) == 0)
+      return -1;
+#else
     pa = walkaddr(pagetable, va + i);
     if(pa == 0)
       panic("loadseg: address should exist");
+#endif
     if(sz - i < PGSIZE)
       n = sz - i;
     else
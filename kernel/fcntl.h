@@ -15,4 +15,14 @@
 
 #define MAP_SHARED      0x01
 #define MAP_PRIVATE     0x02
+
+#define MS_ASYNC        0x1
+#define MS_INVALIDATE   0x2
+#define MS_SYNC         0x4
+
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
 #endif
@@ -25,6 +25,11 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+#ifdef LAB_MMAP
+  int npcache;        // pages in the page cache, see pcache.c
+  int ntext;          // VMA_IMAGE ranges that map it, changed with
+                      // atomics; it may not be written while > 0
+#endif
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
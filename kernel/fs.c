@@ -257,6 +257,17 @@ iget(uint dev, uint inum)
       release(&itable.lock);
       return ip;
     }
+#ifdef LAB_MMAP
+    // Nobody has it open, but its pages are still cached
+    if(ip->ref == 0 && ip->npcache > 0 && ip->dev == dev && ip->inum == inum){
+      ip->ref = 1;
+      release(&itable.lock);
+      return ip;
+    }
+    // Rather a slot without cached pages
+    if(ip->ref == 0 && ip->npcache == 0 && (empty == 0 || empty->npcache > 0))
+      empty = ip;
+#endif
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
       empty = ip;
   }
@@ -266,6 +277,9 @@ iget(uint dev, uint inum)
     panic("iget: no inodes");
 
   ip = empty;
+#ifdef LAB_MMAP
+  pcacheevict(ip);
+#endif
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -507,6 +521,9 @@ itrunc(struct inode *ip)
   }
   #endif
 
+#ifdef LAB_MMAP
+  pcacheevict(ip);
+#endif
   ip->size = 0;
   iupdate(ip);
 }
@@ -539,6 +556,20 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+#ifdef LAB_MMAP
+    // A shared mapping may have written the cached page
+    uint64 pa;
+    if(ip->npcache && (pa = pcachelookup(ip, off)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      int r = either_copyout(user_dst, dst, (char*)pa + off%PGSIZE, m);
+      kfree((void*)pa);
+      if(r == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+#endif
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -571,6 +602,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+#ifdef LAB_MMAP
+  // A program is running from it
+  if(ip->ntext > 0)
+    return -1;
+#endif
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -582,6 +618,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+#ifdef LAB_MMAP
+    pcacheupdate(ip, off, (char*)bp->data + (off % BSIZE), m);
+#endif
     log_write(bp);
     brelse(bp);
   }
@@ -1,6 +1,10 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+// Memory above BUDDYBASE belongs to the buddy allocator
+// (buddy.c), which kalloc() falls back on when it runs out.
+// A kernel thread, kzerod, keeps a pool of zero-filled pages
+// for kalloc_zeroed().
 
 #include "types.h"
 #include "param.h"
@@ -8,8 +12,10 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "page.h"
 
 void freerange(void *pa_start, void *pa_end);
+static void *kzero_pop(void);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -20,24 +26,44 @@ struct run {
 
 #ifdef LAB_LOCK
 // Kmem size per core
-#define KMEM_SIZE_PER_CORE PGROUNDDOWN((PHYSTOP - PGROUNDUP((uint64)end)) / NCPU)
-#define KMEM_ID(pa)        (pa - PGROUNDUP((uint64)end)) / KMEM_SIZE_PER_CORE
+#define KMEM_SIZE_PER_CORE PGROUNDDOWN((BUDDYBASE - PGROUNDUP((uint64)end)) / NCPU)
+
+// Per-core magazine sizes
+#define KMAG_SIZE  64   // A magazine drains once it holds this many pages
+#define KMAG_BATCH 32   // Pages moved between a magazine and kmems at once
 
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;              // Pages on freelist
 } kmems[NCPU];
+
+// A small stack of free pages in front of each core's kmem,
+// which kalloc() and kfree() use without a lock; see kmag_pop().
+struct {
+  struct run *head;
+  int n;                  // changed with atomics
+} kmags[NCPU];
 #else
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;              // Pages on freelist
 } kmem;
 #endif
 
-#ifdef LAB_COW
-// Count how many user processes' page table are referencing this physical page
-int mem_refcount[MEMREF_PGNUM];
-#endif
+// Pool of zero-filled pages, topped up by kzerod
+#define KZERO_HIGH  256   // kzerod stops once the pool holds this many
+#define KZERO_BATCH 16    // kzerod yields after zeroing this many
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+// Frame table; see page.h
+struct page pages[NFRAMES];
 
 void
 kinit()
@@ -47,18 +73,27 @@ kinit()
   for (int i = 0; i < NCPU; i++) {
     initlock(&kmems[i].lock, "kmem");
 
-    uint64 pstart = PGROUNDUP((uint64)end) + KMEM_SIZE_PER_CORE * i;
-    uint64 pend = PGROUNDUP((uint64)end) + KMEM_SIZE_PER_CORE * (i + 1);
-    freerange((void *)pstart, (void *)pend);
+    char *pstart = (char *)PGROUNDUP((uint64)end) + KMEM_SIZE_PER_CORE * i;
+    char *pend = (char *)PGROUNDUP((uint64)end) + KMEM_SIZE_PER_CORE * (i + 1);
+
+    // Seed each core's kmem directly; kfree() would put every
+    // page on the booting core's list.
+    for (char *p = pstart; p + PGSIZE <= pend; p += PGSIZE) {
+      struct run *r = (struct run *)p;
+      memset(p, 1, PGSIZE);
+      r->next = kmems[i].freelist;
+      kmems[i].freelist = r;
+      kmems[i].nfree++;
+    }
   }
   #else
   // A single kmem
   initlock(&kmem.lock, "kmem");
-  #ifdef LAB_COW
-  memset(mem_refcount, 0, sizeof(int) * MEMREF_PGNUM);
-  #endif
-  freerange(end, (void*)PHYSTOP);
+  freerange(end, (void*)BUDDYBASE);
   #endif
+
+  initlock(&kzero.lock, "kzero");
+  buddyinit();
 }
 
 void
@@ -70,6 +105,125 @@ freerange(void *pa_start, void *pa_end)
     kfree(p);
 }
 
+#ifdef LAB_LOCK
+// Magazines are lock-free stacks. The owning core pushes and pops
+// single pages with compare-and-swap, with interrupts off; other
+// cores never push or pop, but may take a whole magazine at once
+// with an atomic swap, when every kmem has run dry. So the head
+// can only change under the owner by becoming 0, and a pop that
+// raced with a take fails its compare-and-swap and tries again.
+
+// Push the n pages from head to tail onto core id's magazine.
+static void
+kmag_push(int id, struct run *head, struct run *tail, int n)
+{
+  struct run *old = __atomic_load_n(&kmags[id].head, __ATOMIC_RELAXED);
+
+  do {
+    tail->next = old;
+  } while (!__atomic_compare_exchange_n(&kmags[id].head, &old, head, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __sync_fetch_and_add(&kmags[id].n, n);
+}
+
+// Pop a page from core id's magazine, or return 0 if it is empty.
+// Only core id may call this.
+static struct run *
+kmag_pop(int id)
+{
+  struct run *r = __atomic_load_n(&kmags[id].head, __ATOMIC_ACQUIRE);
+
+  while (r && !__atomic_compare_exchange_n(&kmags[id].head, &r, r->next, 0,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    ;
+  if (r)
+    __sync_fetch_and_sub(&kmags[id].n, 1);
+  return r;
+}
+
+// Take all of core k's magazine. Returns the pages as a list,
+// with its last page in *tailp and their number in *np.
+static struct run *
+kmag_take(int k, struct run **tailp, int *np)
+{
+  struct run *head, *r;
+  int n = 0;
+
+  head = __atomic_exchange_n(&kmags[k].head, 0, __ATOMIC_ACQUIRE);
+  for (r = head; r; r = r->next) {
+    *tailp = r;
+    n++;
+  }
+  __sync_fetch_and_sub(&kmags[k].n, n);
+  *np = n;
+  return head;
+}
+
+// Put up to KMAG_BATCH free pages in core id's magazine: from the
+// core's own kmem, else from the other kmems, and only once those
+// have run dry, all of another core's magazine.
+// Caller must have interrupts off.
+static void
+kmag_refill(int id)
+{
+  struct run *head = 0, *tail = 0, *r;
+  int n = 0;
+
+  for (int i = 0; i < NCPU && n == 0; i++) {
+    int k = (id + i) % NCPU;
+
+    acquire(&kmems[k].lock);
+    while ((r = kmems[k].freelist) != 0 && n < KMAG_BATCH) {
+      kmems[k].freelist = r->next;
+      if (n == 0)
+        tail = r;
+      r->next = head;
+      head = r;
+      n++;
+    }
+    kmems[k].nfree -= n;
+    release(&kmems[k].lock);
+  }
+
+  for (int i = 1; i < NCPU && n == 0; i++)
+    head = kmag_take((id + i) % NCPU, &tail, &n);
+
+  if (n > 0)
+    kmag_push(id, head, tail, n);
+}
+
+// Return KMAG_BATCH pages from core id's magazine to its own kmem,
+// rather than to the kmem the pages came from, so that pages freed
+// on another core never bounce between locks.
+// Caller must have interrupts off.
+static void
+kmag_drain(int id)
+{
+  struct run *head, *tail, *rest, *last;
+  int n;
+
+  // Take it all, and push back what stays
+  if ((head = kmag_take(id, &last, &n)) == 0)
+    return;   // another core took it meanwhile
+  if (n > KMAG_BATCH) {
+    tail = head;
+    for (int i = 1; i < KMAG_BATCH; i++)
+      tail = tail->next;
+    rest = tail->next;
+    kmag_push(id, rest, last, n - KMAG_BATCH);
+    n = KMAG_BATCH;
+  } else {
+    tail = last;
+  }
+
+  acquire(&kmems[id].lock);
+  tail->next = kmems[id].freelist;
+  kmems[id].freelist = head;
+  kmems[id].nfree += n;
+  release(&kmems[id].lock);
+}
+#endif
+
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -82,10 +236,15 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  #ifdef LAB_COW
+  // Only free the page once its last reference is dropped
   if (mem_dropref((uint64)pa) > 0)
     return;
-  #endif
+
+  // Pages from the buddy region go back to the buddy allocator
+  if ((uint64)pa >= BUDDYBASE) {
+    kfree_pages(pa, 0);
+    return;
+  }
 
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
@@ -94,19 +253,21 @@ kfree(void *pa)
 
   #ifdef LAB_LOCK
 
-  // Find which core's kmem this page belongs to
-  int id = KMEM_ID((uint64)pa);
-
-  acquire(&kmems[id].lock);
-  r->next = kmems[id].freelist;
-  kmems[id].freelist = r;
-  release(&kmems[id].lock);
+  // Push onto this core's magazine and hand a batch
+  // back to this core's kmem once it fills up
+  push_off();
+  int id = cpuid();
+  kmag_push(id, r, r, 1);
+  if (atomic_read4(&kmags[id].n) >= KMAG_SIZE)
+    kmag_drain(id);
+  pop_off();
 
   #else
 
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   release(&kmem.lock);
 
   #endif
@@ -122,34 +283,23 @@ kalloc(void)
 
   #ifdef LAB_LOCK
 
-  // If no pages are available for current CPU, steal from a different CPU
-  int hartid = cpuid();
-  int id = hartid;
-
-  for (int i = 0; i < NCPU; i++) {
-    id = (hartid + i) % NCPU;
-    acquire(&kmems[id].lock);
-    if (kmems[id].freelist) {
-      break;
-    }
-    release(&kmems[id].lock);
-  }
-
-  r = kmems[id].freelist;
-  if (r) {
-    kmems[id].freelist = r->next;
-    release(&kmems[id].lock);
+  // Pop from this core's magazine, refilling it
+  // in one batch when it runs empty
+  push_off();
+  int id = cpuid();
+  if ((r = kmag_pop(id)) == 0) {
+    kmag_refill(id);
+    r = kmag_pop(id);
   }
+  pop_off();
 
   #else
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r) {
+  if(r){
     kmem.freelist = r->next;
-    #ifdef LAB_COW
-    mem_addref((uint64)r);
-    #endif
+    kmem.nfree--;
   }
   release(&kmem.lock);
 
@@ -157,36 +307,159 @@ kalloc(void)
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+  else
+    r = kalloc_pages(0);         // out of pages, try the buddy allocator
+
+  if(r == 0)
+    return kzero_pop();          // last resort, the zeroed pool
 
+  mem_initref((uint64)r);
   return (void*)r;
 }
 
-#ifdef LAB_SYSCALL
-uint64
-mem_freebytes(void) {
-  uint64 bytes = 0;
+// Take a page from the zeroed pool, or return 0 if it is empty.
+// The page was kalloc()ed by kzerod, so it is already referenced.
+static void *
+kzero_pop(void)
+{
   struct run *r;
 
-  r = kmem.freelist;
-  while (r) {
-    r = r->next;
-    bytes += PGSIZE;
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r){
+    kzero.list = r->next;
+    kzero.n--;
   }
+  release(&kzero.lock);
 
-  return bytes;
+  if(r)
+    r->next = 0;  // the only non-zero word
+  return (void*)r;
+}
+
+// Allocate one zero-filled 4096-byte page of physical memory.
+// Prefers the pool kept by kzerod, so the caller usually
+// doesn't pay for the memset.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = kzero_pop()) != 0)
+    return pa;
+
+  if((pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Kernel thread that keeps the zeroed pool topped up.
+// Wakes up once a tick and yields between batches, so it
+// mostly zeroes pages when the CPUs have nothing else to do.
+static void
+kzerod(void)
+{
+  struct run *r;
+  int n;
+
+  for(;;){
+    for(n = 0; n < KZERO_BATCH && atomic_read4(&kzero.n) < KZERO_HIGH; n++){
+      if((r = kalloc()) == 0)
+        break;
+      memset(r, 0, PGSIZE);
+
+      acquire(&kzero.lock);
+      r->next = kzero.list;
+      kzero.list = r;
+      kzero.n++;
+      release(&kzero.lock);
+    }
+
+    if(n == KZERO_BATCH){
+      // More to do, but let others run first
+      yield();
+    } else {
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+void
+kzeroinit(void)
+{
+  if(kthread_create("kzerod", kzerod) < 0)
+    panic("kzeroinit");
+}
+
+// Number of free pages in CPU id's kmem partition.
+// Reads the counters without taking any lock, so
+// monitoring never stalls the allocator; the result
+// is only a snapshot.
+uint64
+mem_freepages(int id) {
+  #ifdef LAB_LOCK
+  return atomic_read4(&kmems[id].nfree) + atomic_read4(&kmags[id].n);
+  #else
+  // A single kmem, reported as CPU 0's partition
+  return id == 0 ? atomic_read4(&kmem.nfree) : 0;
+  #endif
+}
+
+// Total amount of free memory, in bytes.
+uint64
+mem_freebytes(void) {
+  uint64 pages = 0;
+
+  for (int i = 0; i < NCPU; i++)
+    pages += mem_freepages(i);
+  pages += buddy_freepages();
+  pages += atomic_read4(&kzero.n);
+
+  return pages * PGSIZE;
+}
+
+// Reset the frame of a newly allocated page,
+// whose only reference is the caller's.
+void
+mem_initref(uint64 pa) {
+  struct page *pg = PA2PAGE(pa);
+
+  pg->flags = 0;
+  pg->ip = 0;
+  pg->off = 0;
+  pg->next = 0;
+  __atomic_store_n(&pg->refcnt, 1, __ATOMIC_SEQ_CST);
 }
-#endif
 
-#ifdef LAB_COW
+// Take another reference to the page at pa,
+// e.g. for a second page table mapping it.
 void
 mem_addref(uint64 pa) {
-  mem_refcount[MEMREF_INDEX(pa)] ++;
+  __atomic_fetch_add(&PA2PAGE(pa)->refcnt, 1, __ATOMIC_SEQ_CST);
 }
 
+// Drop a reference to the page at pa.
+// Returns the number of references left.
 int
 mem_dropref(uint64 pa) {
-  if (mem_refcount[MEMREF_INDEX(pa)] == 0)
-    return 0;
-  return --mem_refcount[MEMREF_INDEX(pa)];
+  struct page *pg = PA2PAGE(pa);
+  int old = __atomic_load_n(&pg->refcnt, __ATOMIC_SEQ_CST);
+
+  // Pages handed to kfree() by freerange() have no reference
+  // to drop, so never go below zero
+  do {
+    if (old == 0)
+      return 0;
+  } while (!__atomic_compare_exchange_n(&pg->refcnt, &old, old - 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  return old - 1;
+}
+
+// Number of references to the page at pa.
+int
+mem_getref(uint64 pa) {
+  return __atomic_load_n(&PA2PAGE(pa)->refcnt, __ATOMIC_SEQ_CST);
 }
-#endif
@@ -12,7 +12,7 @@ main()
 {
   if(cpuid() == 0){
     consoleinit();
-#if defined(LAB_LOCK)
+#if defined(LAB_LOCK) || defined(LAB_COW) || defined(LAB_MMAP)
     statsinit();
 #endif
     printfinit();
@@ -22,20 +22,35 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    swapinit();      // swap area, once fsinit() has found it
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    shminit();       // shared memory segments
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
+    mbufinit();
     pci_init();
     sockinit();
 #endif
     userinit();      // first user process
+    kzeroinit();     // zeroed page pool
+#ifdef LAB_PGTBL
+    wsetinit();      // working-set sampler
+#endif
+#ifdef LAB_COW
+    mergeinit();     // same-page merging
+#endif
+#ifdef LAB_MMAP
+    pcacheinit();    // page cache for mapped files
+#endif
 #ifdef KCSAN
     kcsaninit();
 #endif
@@ -46,7 +46,8 @@
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
 #ifdef LAB_MMAP
-// user-controlled virtual memory area for each process
+// mmap() maps files between VMABASE and SHMBASE; the heap
+// stops below VMABASE.
 #define VMABASE 0x30000000L
 #endif
 
@@ -55,10 +56,11 @@
 // from physical address 0x80000000 to PHYSTOP.
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
-#ifdef LAB_COW
-#define MEMREF_PGNUM (PHYSTOP - KERNBASE) / PGSIZE
-#define MEMREF_INDEX(pa) (PGROUNDDOWN(pa) - KERNBASE) / PGSIZE
-#endif
+
+// the top of RAM, from BUDDYBASE to PHYSTOP, is managed by
+// the buddy allocator for physically contiguous allocations.
+// must be aligned to its largest block, 2^BUDDY_MAXORDER pages.
+#define BUDDYBASE (PHYSTOP - 32*1024*1024)
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -75,10 +77,19 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mapped files, from VMABASE (mmap lab)
+//   ...
+//   shared memory segments, from SHMBASE
+//   ...
 //   USYSCALL (shared with kernel)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// shmat() maps attachment i at SHMBASE + i*SHMSIZE; the heap
+// stops below SHMBASE.
+#define SHMBASE 0x2000000000L
+#define SHMSIZE (2*1024*1024)   // largest segment
 #ifdef LAB_PGTBL
 #define USYSCALL (TRAPFRAME - PGSIZE)
 
@@ -0,0 +1,247 @@
+// Same-page merging.
+//
+// Processes started from the same binaries often end up with
+// private pages that hold the same bytes. The kmerged kernel
+// thread wakes up every MERGE_INTERVAL ticks and hashes the next
+// NMERGE candidate pages. For each set of candidates with the
+// same hash it keeps one page and maps it in place of the others,
+// which it frees. Merged pages are mapped copy-on-write
+// (PTE_RSW_COW), so the first write to one gets a private copy
+// again, just as after fork(). The hash only finds candidates;
+// pages are compared byte for byte before they are merged.
+//
+// Candidates are anonymous user pages that no other PTE may write
+// through: private pages, and pages shared read-only or
+// copy-on-write. Like the swap clock hand, kmerged only changes
+// the page tables of processes that are not using them (see
+// procquiet()), and leaves megapages, file pages and page-table
+// pages shared since fork() alone.
+//
+// The statistics device reports how many pages merging has freed.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "page.h"
+
+#define NMERGE 256     // candidates hashed per round
+
+extern struct proc proc[NPROC];
+
+struct cand {
+  struct proc *p;      // 0 once merged or given up on
+  int pid;             // p's pid when the page was hashed
+  uint64 va;
+  uint64 pa;
+  uint64 hash;
+};
+
+// Only kmerged changes this; statsmerge() reads the counters
+// without a lock.
+struct {
+  struct cand cands[NMERGE];
+  int n;
+  int hand;            // process the scan is at
+  uint64 handva;       // and where in its memory
+  uint64 rounds;
+  uint64 scanned;      // pages hashed
+  uint64 merged;       // PTEs pointed at another page
+  uint64 freed;        // pages freed by that
+} merge;
+
+// FNV-1a over the page's 64-bit words.
+static uint64
+pagehash(uint64 pa)
+{
+  uint64 *w = (uint64*)pa;
+  uint64 h = 0xcbf29ce484222325ULL;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    h = (h ^ w[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+// Return the PTE of the page at va in p if it may be merged,
+// or 0. Caller holds p->lock.
+static pte_t *
+mergeable(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  int level;
+
+  pte = walkleaf(p->pagetable, va, &level);
+  if(pte == 0 || level != 0 || (*pte & PTE_U) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  if((PA2PAGE(pa)->flags & PG_FILE) || mem_getref(PGROUNDDOWN((uint64)pte)) != 1)
+    return 0;
+  // Shared and writable, like shared memory
+  if((*pte & PTE_W) && mem_getref(pa) != 1)
+    return 0;
+  return pte;
+}
+
+// Hash the candidates from merge.hand and merge.handva on,
+// up to NMERGE of them, into merge.cands.
+static void
+mergescan(void)
+{
+  struct proc *p;
+  struct cand *c;
+  pte_t *pte;
+  uint64 va;
+
+  merge.n = 0;
+  for(int n = 0; n < NPROC; n++){
+    p = &proc[merge.hand];
+    acquire(&p->lock);
+    if(procquiet(p)){
+      for(va = merge.handva; va < p->sz && merge.n < NMERGE; va += PGSIZE){
+        if((pte = mergeable(p, va)) == 0)
+          continue;
+        c = &merge.cands[merge.n++];
+        c->p = p;
+        c->pid = p->pid;
+        c->va = va;
+        c->pa = PTE2PA(*pte);
+        c->hash = pagehash(c->pa);
+      }
+      merge.handva = va;
+    }
+    release(&p->lock);
+    if(merge.n == NMERGE)
+      break;   // go on from merge.handva next round
+    merge.hand = (merge.hand + 1) % NPROC;
+    merge.handva = 0;
+  }
+  merge.scanned += merge.n;
+}
+
+// Lock c's process, if it is still quiet and maps c->pa at
+// c->va. Returns the PTE, holding the process's lock, or 0.
+static pte_t *
+candlock(struct cand *c)
+{
+  pte_t *pte;
+
+  acquire(&c->p->lock);
+  if(c->p->pid == c->pid && procquiet(c->p) &&
+     (pte = mergeable(c->p, c->va)) != 0 && PTE2PA(*pte) == c->pa)
+    return pte;
+  release(&c->p->lock);
+  return 0;
+}
+
+// Map pa at pte, copy-on-write if it was writable.
+// Caller holds p->lock.
+static void
+mergemap(struct proc *p, pte_t *pte, uint64 pa)
+{
+  uint64 flags = PTE_FLAGS(*pte);
+
+  if(flags & PTE_W)
+    flags = (flags & ~PTE_W) | PTE_RSW_COW;
+  *pte = PA2PTE(pa) | flags;
+  p->tlbstale = ~0;
+}
+
+// Merge the later candidates with the same hash as candidate i
+// into its page.
+static void
+mergegroup(int i)
+{
+  struct cand *k = &merge.cands[i], *c;
+  pte_t *pte;
+  int j, shared;
+
+  for(j = i + 1; j < merge.n; j++)
+    if(merge.cands[j].p && merge.cands[j].hash == k->hash)
+      break;
+  if(j == merge.n)
+    return;
+
+  // Write-protect the page that is kept, and hold a reference
+  // so that a write fault copies it: its bytes stay as they
+  // are while the others are compared with it.
+  if((pte = candlock(k)) == 0)
+    return;
+  mergemap(k->p, pte, k->pa);
+  mem_addref(k->pa);
+  release(&k->p->lock);
+  k->p = 0;
+
+  for(; j < merge.n; j++){
+    c = &merge.cands[j];
+    if(c->p == 0 || c->hash != k->hash || c->pa == k->pa)
+      continue;
+    if((pte = candlock(c)) == 0){
+      c->p = 0;
+      continue;
+    }
+    if(memcmp((void*)c->pa, (void*)k->pa, PGSIZE) != 0){
+      // Left for a later candidate of its own
+      release(&c->p->lock);
+      continue;
+    }
+    shared = mem_getref(c->pa) != 1;
+    mergemap(c->p, pte, k->pa);
+    mem_addref(k->pa);
+    release(&c->p->lock);
+    c->p = 0;
+
+    kfree((void*)c->pa);
+    merge.merged++;
+    if(!shared)
+      merge.freed++;
+  }
+
+  kfree((void*)k->pa);
+}
+
+static void
+kmerged(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < MERGE_INTERVAL)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    mergescan();
+    for(int i = 0; i < merge.n; i++)
+      if(merge.cands[i].p)
+        mergegroup(i);
+    merge.rounds++;
+  }
+}
+
+void
+mergeinit(void)
+{
+  if(MERGE_INTERVAL == 0)
+    return;
+  if(kthread_create("kmerged", kmerged) < 0)
+    panic("mergeinit");
+}
+
+// Report merging for the statistics device.
+int
+statsmerge(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "--- same-page merging\n");
+  n += snprintf(buf+n, sz-n, "rounds: %d\n", (int)merge.rounds);
+  n += snprintf(buf+n, sz-n, "pages scanned: %d\n", (int)merge.scanned);
+  n += snprintf(buf+n, sz-n, "pages merged: %d\n", (int)merge.merged);
+  n += snprintf(buf+n, sz-n, "pages saved: %d\n", (int)merge.freed);
+  return n;
+}
@@ -61,6 +61,14 @@ mbuftrim(struct mbuf *m, unsigned int len)
   return m->head + m->len;
 }
 
+static struct kmem_cache *mbuf_cache;
+
+void
+mbufinit(void)
+{
+  mbuf_cache = kmem_cache_create("mbuf", sizeof(struct mbuf), 0);
+}
+
 // Allocates a packet buffer.
 struct mbuf *
 mbufalloc(unsigned int headroom)
@@ -69,7 +77,7 @@ mbufalloc(unsigned int headroom)
 
   if (headroom > MBUF_SIZE)
     return 0;
-  m = kalloc();
+  m = kmem_cache_alloc(mbuf_cache);
   if (m == 0)
     return 0;
   m->next = 0;
@@ -83,7 +91,7 @@ mbufalloc(unsigned int headroom)
 void
 mbuffree(struct mbuf *m)
 {
-  kfree(m);
+  kmem_cache_free(mbuf_cache, m);
 }
 
 // Pushes an mbuf to the end of the queue.
@@ -0,0 +1,19 @@
+// Frame table: one struct page per physical page from KERNBASE
+// to PHYSTOP, shared by kalloc, COW faults and mmap.
+struct page {
+  int refcnt;          // Page table mappings and kernel users of this page;
+                       // only changed with atomics, see mem_addref()
+  uint flags;          // PG_ flags below
+  struct inode *ip;    // PG_FILE: file the page holds data of (not a counted ref)
+  uint off;            // PG_FILE: byte offset of the page in ip
+  struct page *next;   // PG_FILE: next in the page cache's hash chain
+};
+
+#define PG_FILE  (1 << 0)  // holds file data, in the page cache
+#define PG_TEXT  (1 << 1)  // PG_FILE, and mapped as program text
+
+#define NFRAMES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PAGE(pa) (&pages[((uint64)(pa) - KERNBASE) / PGSIZE])
+#define PAGE2PA(pg) (KERNBASE + (uint64)((pg) - pages) * PGSIZE)
+
+extern struct page pages[NFRAMES];
@@ -23,7 +23,23 @@
 #endif
 #endif
 #define MAXPATH      128   // maximum file path name
+#define BUDDY_MAXORDER 10  // largest buddy block is 2^10 pages
+#ifdef LAB_SWAP
+#define SWAPSIZE     65536 // size of swap area in blocks, after the file system
+#else
+#define SWAPSIZE     0     // no swap area
+#endif
+#define NSHM         16    // shared memory segments per system
+#define NSHMAT        8    // shared memory attachments per process
+
+#ifdef LAB_PGTBL
+#define WS_INTERVAL  10    // ticks between working-set samples, 0 for none
+#endif
+
+#ifdef LAB_COW
+#define MERGE_INTERVAL 10  // ticks between same-page merging rounds, 0 for none
+#endif
 
 #ifdef LAB_MMAP
-#define NVMA         16    // maximum number of virtual memory areas
+#define NVMA         16    // mmap()ed ranges per process
 #endif
\ No newline at end of file
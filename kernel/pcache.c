@@ -0,0 +1,319 @@
+// Page cache.
+//
+// Holds whole pages of file data for MAP_SHARED mappings, which
+// map the cached pages themselves: every process that maps the
+// same part of a file sees the same page. read() and write()
+// go through the buffer cache as before, but readi() takes data
+// from a cached page if there is one, since a mapping may have
+// written it, and writei() updates a cached page along with
+// the disk blocks.
+//
+// A page in the cache is marked PG_FILE in the frame table,
+// with the inode and offset it holds, and is found through a
+// hash chain of struct pages. The cache holds one reference to
+// each page, and each mapping another (see mem_addref()).
+// Pages leave the cache when the file is truncated, when the
+// inode table slot of a file nobody has open is reused for
+// another file (see iget()), or when memory runs low and nothing
+// maps them (see pcacheshrink()); pages still mapped then stay
+// mapped until they are unmapped. Programs that are run often
+// thus stay cached between runs.
+//
+// exec() maps the pages of a program's read-only segments from
+// the cache too (see vmaimage()), marked PG_TEXT, so that every
+// process running the program shares them. The file cannot be
+// written while a program runs from it (see ntext in struct
+// inode), since a process could otherwise read in parts of the
+// new program next to the old. A write once they have all
+// exited takes PG_TEXT pages out of the cache rather than
+// changing them, so that the next exec() reads the new contents.
+//
+// The kreadahead kernel thread reads pages into the cache
+// ahead of mappings that are being gone through in order, so
+// that their faults find the pages there.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "page.h"
+
+#define NPCHASH 61
+#define PCHASH(ip, off) ((((uint64)(ip) / sizeof(struct inode)) + (off) / PGSIZE) % NPCHASH)
+#define NRA 8    // readahead requests waiting, at most
+
+struct ra {
+  struct inode *ip;   // a reference of its own
+  uint off;
+  int npages;
+};
+
+struct {
+  struct spinlock lock;
+  struct page *hash[NPCHASH];
+
+  // Readahead requests, for kreadahead
+  struct ra ra[NRA];
+  uint rahead;        // next to take
+  uint ratail;        // next free
+  int rakept;         // slots kept for requests on their way
+  int nreadahead;     // pages read ahead, for statistics
+} pcache;
+
+static void kreadahead(void);
+
+// Called after the first process exists, for kreadahead.
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  if(kthread_create("kreadahead", kreadahead) < 0)
+    panic("pcacheinit");
+}
+
+// Return the cached page that holds ip's data at offset off,
+// with a reference for the caller, or 0 if there is none.
+uint64
+pcachelookup(struct inode *ip, uint off)
+{
+  struct page *pg;
+  uint64 pa;
+
+  off = PGROUNDDOWN(off);
+  acquire(&pcache.lock);
+  for(pg = pcache.hash[PCHASH(ip, off)]; pg; pg = pg->next){
+    if(pg->ip == ip && pg->off == off){
+      pa = PAGE2PA(pg);
+      mem_addref(pa);
+      release(&pcache.lock);
+      return pa;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Return the page that holds ip's data at offset off, reading
+// it into the cache if it is not there, with a reference for
+// the caller. Past the end of the file it holds zeros.
+// Returns 0 if memory ran out.
+// Caller holds ip->lock, so nobody else adds the same page.
+uint64
+pcacheget(struct inode *ip, uint off)
+{
+  struct page *pg;
+  uint64 pa;
+  int h;
+
+  off = PGROUNDDOWN(off);
+  if((pa = pcachelookup(ip, off)) != 0)
+    return pa;
+
+  if((pa = (uint64)kalloc_reclaim(1)) == 0)
+    return 0;
+  if(readi(ip, 0, pa, off, PGSIZE) < 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  pg = PA2PAGE(pa);
+  pg->flags |= PG_FILE;
+  pg->ip = ip;
+  pg->off = off;
+  mem_addref(pa);   // the cache's
+
+  h = PCHASH(ip, off);
+  acquire(&pcache.lock);
+  pg->next = pcache.hash[h];
+  pcache.hash[h] = pg;
+  ip->npcache++;
+  release(&pcache.lock);
+  return pa;
+}
+
+// Mark the cached page at pa as mapped by a program's text.
+void
+pcachetext(uint64 pa)
+{
+  acquire(&pcache.lock);
+  PA2PAGE(pa)->flags |= PG_TEXT;
+  release(&pcache.lock);
+}
+
+// Take the page at pa, which holds ip's data, out of the cache.
+// Caller holds ip->lock and a reference to the page.
+static void
+pcachedrop(struct inode *ip, uint64 pa)
+{
+  struct page *pg = PA2PAGE(pa), **pp;
+
+  acquire(&pcache.lock);
+  for(pp = &pcache.hash[PCHASH(ip, pg->off)]; *pp; pp = &(*pp)->next){
+    if(*pp == pg){
+      *pp = pg->next;
+      pg->next = 0;
+      ip->npcache--;
+      break;
+    }
+  }
+  release(&pcache.lock);
+  kfree((void*)pa);   // the cache's
+}
+
+// writei() wrote n bytes at off in ip, which are now at src;
+// update the cached page, if any, or drop it if programs ran it.
+// Caller holds ip->lock.
+void
+pcacheupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  uint64 pa;
+
+  if(ip->npcache == 0 || (pa = pcachelookup(ip, off)) == 0)
+    return;
+  if(PA2PAGE(pa)->flags & PG_TEXT)
+    pcachedrop(ip, pa);
+  else
+    memmove((char*)pa + off % PGSIZE, src, n);
+  kfree((void*)pa);
+}
+
+// Drop all of ip's pages from the cache.
+// Called when ip is truncated, or its slot reused, so
+// that nobody else can be looking them up.
+void
+pcacheevict(struct inode *ip)
+{
+  struct page *pg, **pp, *gone = 0;
+
+  if(ip->npcache == 0)
+    return;
+
+  acquire(&pcache.lock);
+  for(int h = 0; h < NPCHASH; h++){
+    for(pp = &pcache.hash[h]; (pg = *pp) != 0; ){
+      if(pg->ip == ip){
+        *pp = pg->next;
+        pg->next = gone;
+        gone = pg;
+      } else {
+        pp = &pg->next;
+      }
+    }
+  }
+  ip->npcache = 0;
+  release(&pcache.lock);
+
+  while((pg = gone) != 0){
+    gone = pg->next;
+    pg->next = 0;
+    kfree((void*)PAGE2PA(pg));
+  }
+}
+
+// Drop the cached pages that nothing maps or is using, for
+// kalloc_reclaim() when memory runs low.
+// Returns 0 if it freed any, -1 if not.
+int
+pcacheshrink(void)
+{
+  struct page *pg, **pp, *gone = 0;
+
+  acquire(&pcache.lock);
+  for(int h = 0; h < NPCHASH; h++){
+    for(pp = &pcache.hash[h]; (pg = *pp) != 0; ){
+      // References are only taken under pcache.lock,
+      // or from another one
+      if(mem_getref(PAGE2PA(pg)) == 1){
+        *pp = pg->next;
+        pg->ip->npcache--;
+        pg->next = gone;
+        gone = pg;
+      } else {
+        pp = &pg->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+
+  if(gone == 0)
+    return -1;
+  while((pg = gone) != 0){
+    gone = pg->next;
+    pg->next = 0;
+    kfree((void*)PAGE2PA(pg));
+  }
+  return 0;
+}
+
+// Ask kreadahead to read npages of ip from offset off into the
+// cache. Does nothing if too many requests are waiting already.
+void
+pcachereadahead(struct inode *ip, uint off, int npages)
+{
+  struct ra *r;
+
+  acquire(&pcache.lock);
+  if(pcache.ratail - pcache.rahead + pcache.rakept == NRA){
+    release(&pcache.lock);
+    return;
+  }
+  pcache.rakept++;
+  release(&pcache.lock);
+
+  // Not under pcache.lock, which iget() takes inside
+  // itable.lock; the slot is kept meanwhile
+  ip = idup(ip);
+
+  acquire(&pcache.lock);
+  pcache.rakept--;
+  r = &pcache.ra[pcache.ratail++ % NRA];
+  r->ip = ip;
+  r->off = PGROUNDDOWN(off);
+  r->npages = npages;
+  wakeup(&pcache.ra);
+  release(&pcache.lock);
+}
+
+static void
+kreadahead(void)
+{
+  struct ra r;
+  uint64 pa;
+
+  for(;;){
+    acquire(&pcache.lock);
+    while(pcache.rahead == pcache.ratail)
+      sleep(&pcache.ra, &pcache.lock);
+    r = pcache.ra[pcache.rahead++ % NRA];
+    release(&pcache.lock);
+
+    ilock(r.ip);
+    for(int i = 0; i < r.npages && r.off + i*PGSIZE < r.ip->size; i++){
+      if((pa = pcachelookup(r.ip, r.off + i*PGSIZE)) != 0){
+        kfree((void*)pa);
+        continue;
+      }
+      if((pa = pcacheget(r.ip, r.off + i*PGSIZE)) == 0)
+        break;
+      kfree((void*)pa);
+      __sync_fetch_and_add(&pcache.nreadahead, 1);
+    }
+    iunlock(r.ip);
+
+    // May be the last reference, to a file that was removed
+    begin_op();
+    iput(r.ip);
+    end_op();
+  }
+}
+
+// Report readahead for the statistics device.
+int
+statspcache(char *buf, int sz)
+{
+  return snprintf(buf, sz, "pages read ahead: %d\n", pcache.nreadahead);
+}
@@ -19,6 +19,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipe_cache;
+
+void
+pipeinit(void)
+{
+  pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), 0);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipe_cache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
@@ -47,7 +55,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipe_cache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -71,7 +79,7 @@ pipeclose(struct pipe *pi, int writable)
 #ifdef LAB_LOCK
     freelock(&pi->lock);
 #endif
-    kfree((char*)pi);
+    kmem_cache_free(pipe_cache, pi);
   } else
     release(&pi->lock);
 }
@@ -79,7 +87,7 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, r;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -92,11 +100,24 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      // As much as fits before the buffer is full or wraps
+      uint m = PIPESIZE - (pi->nwrite - pi->nread);
+      if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+        m = PIPESIZE - pi->nwrite % PIPESIZE;
+      if(m > n - i)
+        m = n - i;
+      if(copyin(pr->pagetable, &pi->data[pi->nwrite % PIPESIZE], addr + i, m) == -1){
+        // The source may be swapped out or not touched yet,
+        // and bringing it in takes the disk
+        release(&pi->lock);
+        r = uvmfaultin(pr->pagetable, addr + i, m);
+        acquire(&pi->lock);
+        if(r < 0)
+          break;
+        continue;
+      }
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -108,9 +129,9 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
-  char ch;
+  uint m;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -120,12 +141,27 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    // As much as is buffered before the buffer wraps
+    m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, &pi->data[pi->nread % PIPESIZE], m) == -1){
+      // The destination may be swapped out or not touched
+      // yet, and bringing it in takes the disk
+      release(&pi->lock);
+      r = uvmfaultin(pr->pagetable, addr + i, m);
+      acquire(&pi->lock);
+      if(r < 0)
+        break;
+      m = 0;
+      continue;
+    }
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
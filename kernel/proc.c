@@ -16,6 +16,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -139,7 +140,7 @@ found:
 
   // Allocate usyscall data for lab-3
   #ifdef LAB_PGTBL
-  p->usys = (struct usyscall*)kalloc();
+  p->usys = (struct usyscall*)kalloc_zeroed();
   p->usys->pid = p->pid;
   #endif
 
@@ -192,6 +193,8 @@ freeproc(struct proc *p)
   #ifdef LAB_PGTBL
   if(p->usys)
     kfree((void*)p->usys);
+  p->wssample = 0;
+  p->wshot = p->wscold = p->wssamples = 0;
   #endif
 
   #ifdef LAB_TRAPS
@@ -211,6 +214,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kthread = 0;
   p->state = UNUSED;
 }
 
@@ -226,6 +230,9 @@ proc_pagetable(struct proc *p)
   if(pagetable == 0)
     return 0;
 
+  // Its own TLB entries, under a fresh ASID.
+  asidalloc(p);
+
   // map the trampoline code (for system call return)
   // at the highest user virtual address.
   // only the supervisor uses it, on the way
@@ -309,6 +316,29 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn() in the kernel,
+// with no user memory. fn() must never return; kernel
+// threads ignore kill() and never exit.
+// Returns the new thread's pid, or -1 on failure.
+int
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -319,9 +349,20 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    if(sz + n > SHMBASE)
+      return -1;
+#ifdef LAB_MMAP
+    if(sz + n > VMABASE)
+      return -1;
+#endif
+#ifdef LAB_LAZY
+    // Pages are allocated when first touched, see uvmlazy()
+    sz += n;
+#else
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
+#endif
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -351,6 +392,24 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // The child shares the parent's shared memory segments.
+  if(shmfork(p, np) < 0){
+    shmexit(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+#ifdef LAB_MMAP
+  // And maps the same files.
+  if(vmafork(p, np) < 0){
+    shmexit(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+#endif
+
   // Copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -368,17 +427,6 @@ fork(void)
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
-  #ifdef LAB_MMAP
-  // Copy parents VMAs to child
-  for (i = 0; i < NVMA; i++)
-    if (p->vmas[i].used) {
-      np->vmas[i] = p->vmas[i];
-      // Not share pages with parents
-      np->vmas[i].mapped = 0;
-      filedup(np->vmas[i].f);
-    }
-  #endif
-
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -396,6 +444,71 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path with argv,
+// without first copying the caller's memory the way fork()
+// and exec() would.
+// The child's file descriptor i is a dup of the caller's fdmap[i],
+// or closed if fdmap[i] is -1 or not open; without an fdmap, it
+// gets all of the caller's descriptors, like fork().
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Check fdmap before anything is allocated.
+  if(fdmap){
+    for(i = 0; i < NOFILE; i++){
+      fd = fdmap[i];
+      if(fd < -1 || fd >= NOFILE)
+        return -1;
+    }
+  }
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // Loading the program sleeps, so np->lock cannot be held.
+  // np has no parent yet, so nobody else looks at it.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  // Copy trace mask
+  #ifdef LAB_SYSCALL
+  np->tmask = p->tmask;
+  #endif
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap ? fdmap[i] : i;
+    if(fd >= 0 && p->ofile[fd])
+      np->ofile[i] = filedup(p->ofile[fd]);
+  }
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -436,10 +549,10 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
+  shmexit(p);
+
   #ifdef LAB_MMAP
-  for (int i = 0; i < NVMA; i++){
-    filemunmap(i);
-  }
+  vmaexit(p);
   #endif
 
   acquire(&wait_lock);
@@ -470,6 +583,7 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+again:
   acquire(&wait_lock);
 
   for(;;){
@@ -488,6 +602,10 @@ wait(uint64 addr)
                                   sizeof(pp->xstate)) < 0) {
             release(&pp->lock);
             release(&wait_lock);
+            // addr may just be swapped out or not touched
+            // yet, and bringing it in takes the disk
+            if(uvmfaultin(p->pagetable, addr, sizeof(pp->xstate)) == 0)
+              goto again;
             return -1;
           }
           freeproc(pp);
@@ -610,6 +728,20 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kthread();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -701,6 +833,20 @@ killed(struct proc *p)
   return k;
 }
 
+// Whether another process may change p's user page table:
+// p is not running, and did not stop in the middle of kernel
+// code that may be using it. Kernel code must therefore not
+// sleep while it holds a PTE or a physical address it found
+// in its own page table.
+// Caller holds p->lock.
+int
+procquiet(struct proc *p)
+{
+  if(p->kthread || p->pagetable == 0)
+    return 0;
+  return p->state == SLEEPING || (p->state == RUNNABLE && !p->kpreempted);
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
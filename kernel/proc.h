@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was last flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,17 +83,24 @@ struct trapframe {
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 #ifdef LAB_MMAP
+// A range of user memory that mmap() maps to part of a file.
 struct vma {
-  uint64 start;     // Part of VM might be unmapped
-  // int length;
-  int prot;
-  struct file *f;   // Store file* because `fd` would fail if process
-                    // doesn't have open file, but only `mmap` has
-  int foffset;      //
-  int flags;
-  int used;
-  int mapped;       // Lazy allocation causes map to be delayed
+  uint64 start;     // page-aligned
+  uint64 end;       // page-aligned, not included
+  int prot;         // PROT_ flags
+  int flags;        // MAP_SHARED or MAP_PRIVATE, and VMA_IMAGE
+  struct file *f;   // a reference of its own, so the mapping
+                    // outlives the file descriptor
+  uint64 off;       // file offset that start maps
+  uint64 lastfault; // for spotting faults in order
+  uint64 raend;     // end of what was read ahead
+  int advice;       // MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL
 };
+
+// A range of the program that exec() loaded, below p->sz,
+// that is read in as it is touched. Its pages are part of
+// the process's memory, like the heap's.
+#define VMA_IMAGE 0x100
 #endif
 
 // Per-process state
@@ -118,6 +126,12 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kthread)(void);       // Entry point, if this is a kernel thread
+  uint64 asid;                 // Tags the TLB entries of pagetable
+  uint64 asidgen;              // Generation asid belongs to
+  uint tlbstale;               // Harts that may cache stale entries for asid
+  int kpreempted;              // Preempted in kernel code; see swap.c
+  struct shmseg *shm[NSHMAT];  // Attached shared memory segments
 
   #ifdef LAB_SYSCALL
   int tmask;                   // Trace system calls
@@ -125,6 +139,10 @@ struct proc {
 
   #ifdef LAB_PGTBL
   struct usyscall *usys;       // A read-only page that demos data sharing between user and kernel
+  int wssample;                // wsetd wants a working-set sample; see wset.c
+  uint64 wshot;                // Pages accessed in the last sampling interval
+  uint64 wscold;               // Mapped pages not accessed in it
+  uint64 wssamples;            // Number of samples taken
   #endif
 
   #ifdef LAB_TRAPS
@@ -134,6 +152,7 @@ struct proc {
   #endif
 
   #ifdef LAB_MMAP
-  struct vma vmas[NVMA];
+  struct vma vmas[NVMA];       // mmap()ed ranges, sorted by start
+  int nvma;
   #endif
 };
@@ -199,7 +199,8 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define MAKE_SATP(pagetable, asid) \
+  (SATP_SV39 | ((uint64)(asid) << SATP_ASIDSHIFT) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -335,6 +336,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -343,6 +351,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
 
+// satp's address-space identifier, tagging TLB entries; see asid.c.
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK (0xffffL << SATP_ASIDSHIFT)
+
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
@@ -352,11 +364,27 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
 #define PTE_A (1L << 6) // pagetable entry accessed
+#define PTE_D (1L << 7) // pagetable entry written
+
+#ifdef LAB_PGTBL
+#define PTE_SWA (1L << 9) // PTE_A, as taken away by the working-set sampler
+#endif
 
 #ifdef LAB_COW
 #define PTE_RSW_COW (1L << 8)
 #endif
 
+// a valid PTE with any of R/W/X set is a leaf; otherwise it
+// points to the next level of the page table.
+#define PTE_LEAF(pte) (((pte) & (PTE_R|PTE_W|PTE_X)) != 0)
+
+// a PTE without PTE_V that is not zero stands for a page that
+// was written out to swap: the swap slot takes the place of the
+// physical page number, and the page's flags are kept.
+#define PTE_SWAPPED(pte) (((pte) & PTE_V) == 0 && (pte) != 0)
+#define SLOT2PTE(slot, flags) (((uint64)(slot) << 10) | ((flags) & ~PTE_V))
+#define PTE2SLOT(pte) ((uint)((pte) >> 10))
+
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
 
@@ -369,6 +397,13 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes mapped by a leaf PTE at the given level: a 4096-byte
+// page at level 0, a 2 MiB megapage at level 1, and a 1 GiB
+// gigapage at level 2.
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
+#define MEGAPGSIZE LEVELSIZE(1)
+#define MEGAPGORDER 9  // a megapage is 2^9 pages, for kalloc_pages()
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
@@ -0,0 +1,276 @@
+// Shared memory segments.
+//
+// shmget(key, size) finds the segment with the given key, or
+// creates it; key 0 always creates a new one, which no key
+// finds, though any process that knows its id can attach
+// it. shmat(id) maps
+// the segment's pages into the caller's address space, and
+// shmdt(addr) unmaps them again. Nothing is copied: every
+// process that attaches a segment maps the same pages.
+//
+// A segment holds one reference to each of its pages, and each
+// attachment another (see mem_addref()). Attachment i of a
+// process is at SHMBASE + i*SHMSIZE. fork() attaches the child
+// to all of the parent's segments; exec() and exit() detach
+// them. The process that created a segment counts as one more
+// attachment until it detaches the segment, execs or exits,
+// so a segment nobody attached does not stay forever. A
+// segment goes away when its last attachment does.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SHM_MAXPAGES (SHMSIZE / PGSIZE)
+
+struct shmseg {
+  int key;          // 0 for a private segment
+  int nattach;      // attachments, in all processes
+  int creator;      // pid of the creator while it counts in nattach
+  int npages;       // 0 if this entry is free
+  uint64 *pages;    // a kalloc()ed page of physical addresses
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg segs[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+static void
+shmfree(uint64 *pages, int npages)
+{
+  for(int i = 0; i < npages; i++)
+    kfree((void*)pages[i]);
+  kfree(pages);
+}
+
+// Caller holds shm.lock.
+static int
+shmlookup(int key)
+{
+  if(key == 0)
+    return -1;
+  for(int id = 0; id < NSHM; id++)
+    if(shm.segs[id].npages != 0 && shm.segs[id].key == key)
+      return id;
+  return -1;
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes if there is none.
+// Returns -1 if it exists but is smaller than size, or if
+// the segments or memory ran out.
+int
+shmget(int key, int size)
+{
+  int id, npages = PGROUNDUP((uint64)size) / PGSIZE;
+  uint64 *pages;
+  struct shmseg *s;
+
+  if(size <= 0 || npages > SHM_MAXPAGES)
+    return -1;
+
+  acquire(&shm.lock);
+  if((id = shmlookup(key)) >= 0)
+    goto found;
+  release(&shm.lock);
+
+  // Allocate without the lock; someone else may
+  // create the same key meanwhile
+  if((pages = kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < npages; i++){
+    if((pages[i] = (uint64)kalloc_zeroed()) == 0){
+      shmfree(pages, i);
+      return -1;
+    }
+  }
+
+  acquire(&shm.lock);
+  if((id = shmlookup(key)) >= 0){
+    shmfree(pages, npages);
+    goto found;
+  }
+  for(id = 0; id < NSHM; id++){
+    s = &shm.segs[id];
+    if(s->npages == 0){
+      s->key = key;
+      s->nattach = 1;   // the creator
+      s->creator = myproc()->pid;
+      s->npages = npages;
+      s->pages = pages;
+      release(&shm.lock);
+      return id;
+    }
+  }
+  release(&shm.lock);
+  shmfree(pages, npages);
+  return -1;
+
+found:
+  if(shm.segs[id].npages < npages)
+    id = -1;
+  release(&shm.lock);
+  return id;
+}
+
+// Drop an attachment of s, freeing s with the last one.
+static void
+shmput(struct shmseg *s)
+{
+  uint64 *pages = 0;
+  int npages = 0;
+
+  acquire(&shm.lock);
+  if(--s->nattach == 0){
+    pages = s->pages;
+    npages = s->npages;
+    s->npages = 0;
+    s->pages = 0;
+  }
+  release(&shm.lock);
+
+  if(pages)
+    shmfree(pages, npages);
+}
+
+// Drop the attachment the creator of s counts as, if p is it.
+static void
+shmdisown(struct proc *p, struct shmseg *s)
+{
+  int own;
+
+  acquire(&shm.lock);
+  own = s->npages != 0 && s->creator == p->pid;
+  if(own)
+    s->creator = 0;
+  release(&shm.lock);
+
+  if(own)
+    shmput(s);
+}
+
+// Map s as attachment i of p. The caller has counted the
+// attachment in s->nattach, and drops it again on failure.
+// Returns 0, or -1 if out of memory.
+static int
+shmmap(struct proc *p, int i, struct shmseg *s)
+{
+  uint64 va = SHMBASE + (uint64)i * SHMSIZE;
+
+  for(int j = 0; j < s->npages; j++){
+    if(mappages(p->pagetable, va + (uint64)j*PGSIZE, PGSIZE, s->pages[j],
+                PTE_R|PTE_W|PTE_U) != 0){
+      uvmunmap(p->pagetable, va, j, 1);
+      return -1;
+    }
+    mem_addref(s->pages[j]);
+  }
+  p->shm[i] = s;
+  return 0;
+}
+
+// Attach segment id to the current process.
+// Returns the address it is mapped at, or -1.
+uint64
+shmattach(int id)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  int i;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  for(i = 0; i < NSHMAT; i++)
+    if(p->shm[i] == 0)
+      break;
+  if(i == NSHMAT)
+    return -1;
+
+  s = &shm.segs[id];
+  acquire(&shm.lock);
+  if(s->npages == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  s->nattach++;
+  release(&shm.lock);
+
+  if(shmmap(p, i, s) != 0){
+    shmput(s);
+    return -1;
+  }
+  return SHMBASE + (uint64)i * SHMSIZE;
+}
+
+// Detach attachment i of p.
+static void
+shmunmap(struct proc *p, int i)
+{
+  struct shmseg *s = p->shm[i];
+
+  uvmunmap(p->pagetable, SHMBASE + (uint64)i * SHMSIZE, s->npages, 1);
+  p->shm[i] = 0;
+  shmdisown(p, s);
+  shmput(s);
+}
+
+// Detach the segment the current process attached at addr.
+int
+shmdetach(uint64 addr)
+{
+  struct proc *p = myproc();
+  int i;
+
+  if(addr < SHMBASE || (addr - SHMBASE) % SHMSIZE != 0)
+    return -1;
+  i = (addr - SHMBASE) / SHMSIZE;
+  if(i >= NSHMAT || p->shm[i] == 0)
+    return -1;
+  shmunmap(p, i);
+  return 0;
+}
+
+// Attach child np to all of p's segments, at the same addresses.
+// Returns 0, or -1 if out of memory.
+int
+shmfork(struct proc *p, struct proc *np)
+{
+  struct shmseg *s;
+
+  for(int i = 0; i < NSHMAT; i++){
+    if((s = p->shm[i]) == 0)
+      continue;
+    acquire(&shm.lock);
+    s->nattach++;
+    release(&shm.lock);
+    if(shmmap(np, i, s) != 0){
+      shmput(s);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Detach all of p's segments, including those p created but
+// never attached, for exec() and exit(), and for fork() when
+// it fails.
+void
+shmexit(struct proc *p)
+{
+  for(int i = 0; i < NSHMAT; i++)
+    if(p->shm[i])
+      shmunmap(p, i);
+  for(int id = 0; id < NSHM; id++)
+    shmdisown(p, &shm.segs[id]);
+}
@@ -0,0 +1,229 @@
+// Slab allocator for small fixed-size kernel objects.
+//
+// A cache hands out objects of one size, carved out of slabs:
+// one page from kalloc(), or a larger block from kalloc_pages()
+// when objects do not pack well into a single page. A slab
+// starts with a struct slab header, followed by its objects.
+// Slabs are aligned to their own size, so an object finds its
+// slab by rounding its address down.
+//
+// Each CPU keeps a few free objects of every cache, touched
+// only with interrupts off, so most allocations and frees do
+// not take the cache lock. They move to and from the cache's
+// partial slabs in batches.
+//
+// Interface:
+// * kmem_cache_create(name, size, ctor) makes a cache; only
+//     called while booting.
+// * kmem_cache_alloc(c) returns an object, or 0.
+// * kmem_cache_free(c, obj) gives it back.
+// * ctor, if set, runs on an object when it leaves its slab,
+//     not on every allocation: objects recycled through a CPU's
+//     cache skip it, so they should be freed in their
+//     constructed state.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE        8   // maximum number of caches
+#define SLAB_CPU_SIZE 16  // free objects cached per CPU
+#define SLAB_BATCH    8   // objects moved per refill/drain
+#define SLAB_MAXORDER 3   // largest slab is 2^3 pages
+
+struct slab {
+  struct slab *next;   // next slab on the cache's partial list
+  void *freelist;      // free objects in this slab
+  int inuse;           // number of objects handed out
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;           // object size, rounded up to 8 bytes
+  int order;           // slab size is 2^order pages
+  int perslab;         // objects per slab
+  void (*ctor)(void*);
+
+  struct spinlock lock;
+  struct slab *partial;  // slabs with free objects
+
+  struct {
+    void *objs[SLAB_CPU_SIZE];
+    int n;
+  } cpu[NCPU];
+};
+
+static struct kmem_cache caches[NCACHE];
+static int ncache;
+
+#define SLAB_HDRSZ      ((sizeof(struct slab) + 7) & ~7)
+#define SLAB_BYTES(c)   ((uint64)PGSIZE << (c)->order)
+#define OBJ2SLAB(c, o)  ((struct slab *)((uint64)(o) & ~(SLAB_BYTES(c) - 1)))
+
+// Create a cache of objects of the given size.
+struct kmem_cache *
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  if (ncache >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+
+  c = &caches[ncache++];
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  c->ctor = ctor;
+  c->partial = 0;
+  initlock(&c->lock, "slab");
+
+  // Smallest slab that wastes no more than an eighth of itself
+  for (c->order = 0; c->order < SLAB_MAXORDER; c->order++) {
+    uint64 avail = SLAB_BYTES(c) - SLAB_HDRSZ;
+    if (c->size <= avail && avail % c->size <= SLAB_BYTES(c) / 8)
+      break;
+  }
+  c->perslab = (SLAB_BYTES(c) - SLAB_HDRSZ) / c->size;
+  if (c->perslab == 0)
+    panic("kmem_cache_create: object too large");
+
+  return c;
+}
+
+// Allocate a new slab and thread its objects onto its freelist.
+// Returns 0 if out of memory.
+static struct slab *
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if (c->order == 0)
+    s = kalloc();
+  else
+    s = kalloc_pages(c->order);
+  if (s == 0)
+    return 0;
+
+  s->next = 0;
+  s->freelist = 0;
+  s->inuse = 0;
+
+  // Thread the objects onto the freelist back to front,
+  // so they are handed out in address order
+  obj = (char *)s + SLAB_HDRSZ + (c->perslab - 1) * c->size;
+  for (int i = 0; i < c->perslab; i++, obj -= c->size) {
+    *(void **)obj = s->freelist;
+    s->freelist = obj;
+  }
+  return s;
+}
+
+static void
+slab_release(struct kmem_cache *c, struct slab *s)
+{
+  if (c->order == 0)
+    kfree(s);
+  else
+    kfree_pages(s, c->order);
+}
+
+// Move up to SLAB_BATCH objects from the partial slabs
+// into this CPU's cache, growing the cache if needed.
+// Caller must have interrupts off.
+static void
+slab_refill(struct kmem_cache *c, int id)
+{
+  struct slab *s;
+
+  acquire(&c->lock);
+  if (c->partial == 0) {
+    // kalloc() may spin on other locks; drop ours meanwhile
+    release(&c->lock);
+    s = slab_grow(c);
+    acquire(&c->lock);
+    if (s) {
+      s->next = c->partial;
+      c->partial = s;
+    }
+  }
+
+  while ((s = c->partial) && c->cpu[id].n < SLAB_BATCH) {
+    void *obj = s->freelist;
+    s->freelist = *(void **)obj;
+    s->inuse++;
+    if (c->ctor)
+      c->ctor(obj);
+    c->cpu[id].objs[c->cpu[id].n++] = obj;
+    if (s->freelist == 0)
+      c->partial = s->next;   // full slabs are not tracked
+  }
+  release(&c->lock);
+}
+
+// Return SLAB_BATCH objects from this CPU's cache to their slabs,
+// freeing any slab that becomes empty.
+// Caller must have interrupts off.
+static void
+slab_drain(struct kmem_cache *c, int id)
+{
+  struct slab *s, **pp;
+
+  acquire(&c->lock);
+  for (int i = 0; i < SLAB_BATCH; i++) {
+    void *obj = c->cpu[id].objs[--c->cpu[id].n];
+    s = OBJ2SLAB(c, obj);
+
+    if (s->freelist == 0) {
+      // Was full, so it is back to being partial
+      s->next = c->partial;
+      c->partial = s;
+    }
+    *(void **)obj = s->freelist;
+    s->freelist = obj;
+
+    if (--s->inuse == 0 && !(c->partial == s && s->next == 0)) {
+      // Empty, and not the last partial slab; give it back
+      for (pp = &c->partial; *pp != s; pp = &(*pp)->next)
+        ;
+      *pp = s->next;
+      slab_release(c, s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+
+  push_off();
+  int id = cpuid();
+  if (c->cpu[id].n == 0)
+    slab_refill(c, id);
+  if (c->cpu[id].n > 0)
+    obj = c->cpu[id].objs[--c->cpu[id].n];
+  pop_off();
+
+  return obj;
+}
+
+// Free an object that was returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  if (obj == 0 || OBJ2SLAB(c, obj) == obj)
+    panic("kmem_cache_free");
+
+  push_off();
+  int id = cpuid();
+  if (c->cpu[id].n == SLAB_CPU_SIZE)
+    slab_drain(c, id);
+  c->cpu[id].objs[c->cpu[id].n++] = obj;
+  pop_off();
+}
@@ -39,6 +39,14 @@ statsread(int user_dst, uint64 dst, int n)
 #endif
 #ifdef LAB_LOCK
     stats.sz = statslock(stats.buf, BUFSZ);
+    stats.sz += statsbuddy(stats.buf + stats.sz, BUFSZ - stats.sz);
+#endif
+#ifdef LAB_COW
+    stats.sz = statsmerge(stats.buf, BUFSZ);
+#endif
+#ifdef LAB_MMAP
+    stats.sz = statsvma(stats.buf, BUFSZ);
+    stats.sz += statspcache(stats.buf + stats.sz, BUFSZ - stats.sz);
 #endif
   }
   m = stats.sz - stats.off;
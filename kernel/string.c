@@ -1,13 +1,30 @@
 #include "types.h"
 
+// memset and memmove work a byte at a time only up to the
+// first 8-byte boundary and after the last one; in between
+// they move aligned 8-byte words, 32 bytes per iteration.
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w = (uchar)c * 0x0101010101010101UL;
+
+  while(n > 0 && ((uint64)cdst & 7) != 0){
+    *cdst++ = c;
+    n--;
+  }
+  for(; n >= 32; n -= 32, cdst += 32){
+    uint64 *wdst = (uint64 *) cdst;
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= 8; n -= 8, cdst += 8)
+    *(uint64 *) cdst = w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -27,25 +44,73 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Words can only be used if src and dst are equally aligned.
+// Each group of four words is loaded before any of it is
+// stored, so overlapping copies stay correct.
 void*
 memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  int words;
+  uint64 w0, w1, w2, w3;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  words = (((uint64)s ^ (uint64)d) & 7) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 32; n -= 32){
+        s -= 32;
+        d -= 32;
+        w0 = ((uint64 *)s)[0];
+        w1 = ((uint64 *)s)[1];
+        w2 = ((uint64 *)s)[2];
+        w3 = ((uint64 *)s)[3];
+        ((uint64 *)d)[3] = w3;
+        ((uint64 *)d)[2] = w2;
+        ((uint64 *)d)[1] = w1;
+        ((uint64 *)d)[0] = w0;
+      }
+      for(; n >= 8; n -= 8){
+        s -= 8;
+        d -= 8;
+        *(uint64 *)d = *(uint64 *)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 32; n -= 32, s += 32, d += 32){
+        w0 = ((uint64 *)s)[0];
+        w1 = ((uint64 *)s)[1];
+        w2 = ((uint64 *)s)[2];
+        w3 = ((uint64 *)s)[3];
+        ((uint64 *)d)[0] = w0;
+        ((uint64 *)d)[1] = w1;
+        ((uint64 *)d)[2] = w2;
+        ((uint64 *)d)[3] = w3;
+      }
+      for(; n >= 8; n -= 8, s += 8, d += 8)
+        *(uint64 *)d = *(uint64 *)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -0,0 +1,316 @@
+// Swap.
+//
+// When memory runs low, user pages that have not been used
+// lately are written out to the swap area, which mkfs reserves
+// on the disk after the file system, and their frames freed.
+// There is a swap area only if the kernel is built with SWAP=1
+// (LAB_SWAP); without one, nothing is ever swapped out.
+//
+// A swapped-out page keeps its PTE, with PTE_V clear and the
+// swap slot in place of the physical page number (see
+// SLOT2PTE in riscv.h). The next access faults, and swapin()
+// reads the page back. A slot is counted in swap.ref once for
+// every PTE that refers to it, so fork() can share it.
+//
+// The clock hand sweeps over all processes' pages. It clears
+// PTE_A as it passes; a page whose PTE_A is still clear when
+// the hand comes back has not been used for a whole lap, and is
+// the one to go. Only private anonymous pages are taken: not
+// megapages, pages mapped more than once, file pages, or pages
+// in page-table pages shared since fork(). In the pgtbl lab,
+// PTE_SWA, where the working-set sampler keeps PTE_A, counts as
+// PTE_A too.
+//
+// The hand must not change the page table of a process that
+// may be using it. It looks at the caller, and at processes
+// that are sleeping or were preempted in user space (see
+// procquiet()).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+#include "page.h"
+
+#define BPP (PGSIZE / BSIZE)           // blocks per page
+#define NSLOT (SWAPSIZE / BPP)         // largest number of slots
+#define SWAP_LOW 64                    // keep this many pages free
+
+// PTE bits that say a page was used since the hand last came by:
+// the working-set sampler moves PTE_A into PTE_SWA
+#ifdef LAB_PGTBL
+#define PTE_USED (PTE_A|PTE_SWA)
+#else
+#define PTE_USED PTE_A
+#endif
+
+extern struct proc proc[NPROC];
+extern struct superblock sb;
+
+struct {
+  struct spinlock lock;
+  ushort ref[NSLOT];      // PTEs referring to each slot, 0 if free
+  uint next;              // where to look for a free slot
+  uint nused;             // slots in use
+
+  // Swap I/O, and the clock hand
+  struct sleeplock iolock;
+  int hand;               // process the hand is at
+  uint64 handva;          // and where in its memory
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+}
+
+// Number of slots in the swap area; 0 until fsinit()
+// has read the superblock.
+static uint
+nslots(void)
+{
+  uint n = sb.nswap / BPP;
+  return n < NSLOT ? n : NSLOT;
+}
+
+// Returns a free slot, with one reference, or -1.
+static int
+slotalloc(void)
+{
+  uint n = nslots();
+
+  acquire(&swap.lock);
+  for(uint i = 0; i < n; i++){
+    uint s = (swap.next + i) % n;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another PTE refers to slot, e.g. in a child after fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSLOT || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE no longer refers to slot.
+void
+swapput(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSLOT || swap.ref[slot] == 0)
+    panic("swapput");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Number of free slots.
+int
+swapnfree(void)
+{
+  int nfree;
+
+  acquire(&swap.lock);
+  nfree = nslots() - swap.nused;
+  release(&swap.lock);
+  return nfree;
+}
+
+// Read or write the page at pa from or to slot.
+// Caller holds swap.iolock.
+static void
+swaprw(uint slot, char *pa, int write)
+{
+  struct buf *b;
+  uint blockno = sb.swapstart + slot * BPP;
+
+  for(int i = 0; i < BPP; i++){
+    if(write){
+      b = bgetblk(ROOTDEV, blockno + i);
+      memmove(b->data, pa + i*BSIZE, BSIZE);
+      bwrite(b);
+    } else {
+      b = bread(ROOTDEV, blockno + i);
+      memmove(pa + i*BSIZE, b->data, BSIZE);
+    }
+    brelse(b);
+  }
+}
+
+// Whether the clock hand may change p's page table.
+// Caller holds p->lock.
+static int
+swappable(struct proc *p)
+{
+  if(p == myproc())
+    return p->kthread == 0 && p->pagetable != 0;
+  return procquiet(p);
+}
+
+// Move the hand over p's pages from swap.handva up, clearing
+// PTE_USED, to the first page that may be swapped out.
+// Returns its PTE, with swap.handva at its address, or 0.
+// Caller holds p->lock.
+static pte_t *
+swapscan(struct proc *p)
+{
+  pte_t *pte;
+  uint64 va, pa;
+  int level;
+
+  for(va = swap.handva; va < p->sz; va += PGSIZE){
+    pte = walkleaf(p->pagetable, va, &level);
+    if(pte == 0 || level != 0 || (*pte & PTE_U) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(mem_getref(pa) != 1 || (PA2PAGE(pa)->flags & PG_FILE) ||
+       mem_getref(PGROUNDDOWN((uint64)pte)) != 1)
+      continue;
+    if(__atomic_fetch_and(pte, ~PTE_USED, __ATOMIC_RELAXED) & PTE_USED){
+      // Used since the hand last came by
+      p->tlbstale = ~0;
+      continue;
+    }
+    swap.handva = va;
+    return pte;
+  }
+  return 0;
+}
+
+// Write one page that has not been used lately out to swap,
+// and free it.
+// Returns 0 if it freed a page, -1 if it found none to free.
+int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 pa;
+  int slot;
+
+  if(nslots() == 0)
+    return -1;
+
+  acquiresleep(&swap.iolock);
+  // Two laps at most: the first may only clear PTE_A
+  for(int n = 0; n <= 2*NPROC; n++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(swappable(p) && (pte = swapscan(p)) != 0){
+      if((slot = slotalloc()) < 0){
+        release(&p->lock);
+        break;
+      }
+      pa = PTE2PA(*pte);
+      *pte = SLOT2PTE(slot, PTE_FLAGS(*pte));
+      p->tlbstale = ~0;
+      swap.handva += PGSIZE;
+      release(&p->lock);
+
+      // p may fault on the page meanwhile; swapin()
+      // waits for swap.iolock before it reads the slot.
+      swaprw(slot, (char*)pa, 1);
+      releasesleep(&swap.iolock);
+      kfree((void*)pa);
+      return 0;
+    }
+    release(&p->lock);
+    swap.hand = (swap.hand + 1) % NPROC;
+    swap.handva = 0;
+  }
+  releasesleep(&swap.iolock);
+  return -1;
+}
+
+// Bring the page at va in pagetable, which must be the current
+// process's, back from swap.
+// Returns 0 if it did, -1 if va is not swapped out, or the
+// caller holds spinlocks and may not wait for the disk, or
+// memory ran out.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  uint slot;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0 ||
+     !PTE_SWAPPED(*pte) || !maysleep())
+    return -1;
+  slot = PTE2SLOT(*pte);
+
+  if((mem = kalloc_reclaim(0)) == 0)
+    return -1;
+  acquiresleep(&swap.iolock);
+  swaprw(slot, mem, 0);
+  releasesleep(&swap.iolock);
+
+#ifdef LAB_COW
+  // The page-table page may be shared since fork()
+  if(uvmunshare(pagetable, va) != 0){
+    kfree(mem);
+    return -1;
+  }
+#endif
+  // Only this process changes a swapped-out PTE, but the
+  // page-table page may have moved while it slept
+  pte = walk(pagetable, va, 0);
+  *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_V;
+  asidstale(pagetable);
+  swapput(slot);
+  return 0;
+}
+
+// Swap in whatever is swapped out of [va, va+len); see also
+// uvmfaultin().
+// Returns 0 if it swapped anything in, -1 if not.
+int
+swapinrange(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  uint64 a;
+  int r = -1;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(swapin(pagetable, a) == 0)
+      r = 0;
+  }
+  return r;
+}
+
+// kalloc(), or kalloc_zeroed() if zeroed, for user memory:
+// when free memory runs low, swap pages out to make room.
+// May sleep, unless the caller holds spinlocks.
+void *
+kalloc_reclaim(int zeroed)
+{
+#ifdef LAB_MMAP
+  // Cached file pages that nothing maps go first
+  if(mem_freebytes() < SWAP_LOW*PGSIZE)
+    pcacheshrink();
+#endif
+  while(mem_freebytes() < SWAP_LOW*PGSIZE && maysleep() && swapout() == 0)
+    ;
+  return zeroed ? kalloc_zeroed() : kalloc();
+}
@@ -101,12 +101,18 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
 #ifdef LAB_SYSCALL
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
 #endif
 #ifdef LAB_PGTBL
 extern uint64 sys_pgaccess(void);
+extern uint64 sys_pgscan(void);
+extern uint64 sys_wsinfo(void);
 #endif
 #ifdef LAB_TRAPS
 extern uint64 sys_sigalarm(void);
@@ -121,6 +127,8 @@ extern uint64 sys_symlink(void);
 #ifdef LAB_MMAP
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_madvise(void);
 #endif
 
 // An array mapping syscall numbers from syscall.h
@@ -147,12 +155,18 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_spawn]   sys_spawn,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
 #ifdef LAB_SYSCALL
 [SYS_trace]   sys_trace,
 [SYS_sysinfo] sys_sysinfo,
 #endif
 #ifdef LAB_PGTBL
 [SYS_pgaccess] sys_pgaccess,
+[SYS_pgscan]   sys_pgscan,
+[SYS_wsinfo]   sys_wsinfo,
 #endif
 #ifdef LAB_TRAPS
 [SYS_sigalarm]  sys_sigalarm,
@@ -167,6 +181,8 @@ static uint64 (*syscalls[])(void) = {
 #ifdef LAB_MMAP
 [SYS_mmap]   sys_mmap,
 [SYS_munmap] sys_munmap,
+[SYS_msync]  sys_msync,
+[SYS_madvise] sys_madvise,
 #endif
 };
 
@@ -193,6 +209,10 @@ static const char *syscall_names[] = {
 [SYS_link]    "link",
 [SYS_mkdir]   "mkdir",
 [SYS_close]   "close",
+[SYS_spawn]   "spawn",
+[SYS_shmget]  "shmget",
+[SYS_shmat]   "shmat",
+[SYS_shmdt]   "shmdt",
 [SYS_trace]   "trace",
 [SYS_sysinfo] "sysinfo",
 };
@@ -31,3 +31,12 @@
 #define SYS_munmap    28
 #define SYS_connect   29
 #define SYS_pgaccess  30
+
+#define SYS_spawn  31
+#define SYS_pgscan 32
+#define SYS_wsinfo 33
+#define SYS_shmget 34
+#define SYS_shmat  35
+#define SYS_shmdt  36
+#define SYS_msync  37
+#define SYS_madvise 38
@@ -15,9 +15,6 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
-#ifdef LAB_MMAP
-#include "memlayout.h"
-#endif
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -411,6 +408,15 @@ sys_open(void)
   }
   #endif
 
+#ifdef LAB_MMAP
+  // A program is running from it; see writei()
+  if((omode & O_TRUNC) && ip->ntext > 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+#endif
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -500,20 +506,25 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the user's argument vector at uargv into argv[MAXARG],
+// one kalloc()ed page per string.
+// Returns 0, or -1 with nothing left allocated.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -529,18 +540,54 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fdmap[NOFILE];
+  uint64 uargv, ufdmap;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufdmap);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(ufdmap != 0 &&
+     copyin(myproc()->pagetable, (char *)fdmap, ufdmap, sizeof(fdmap)) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = spawn(path, argv, ufdmap ? fdmap : 0);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -634,101 +681,51 @@ sys_symlink(void)
 uint64
 sys_mmap(void)
 {
-  // In this lab, assuming:
-  // - kernel always decides the VA to map the file
-  // - `addr` and `offset` are zero
-
-  int length;    // number of bytes to map
-  int prot;      // OPTIONS: readable, writeable, executable
-  int flags;     // OPTIONS: MAP_SHARED, MAP_PRIVATE
-  int fd;        // the open file descriptor of the file to map
+  uint64 addr, length, offset;
+  int prot, flags;
+  struct file *f;
 
-  argint(1, &length);
+  argaddr(0, &addr);    // a hint, which is ignored
+  argaddr(1, &length);
   argint(2, &prot);
   argint(3, &flags);
-  argint(4, &fd);
-
-  struct proc *p = myproc();
-  struct file *f = p->ofile[fd];
-
-  // Check if file permission allows `mmap`
-  if (!f->readable)
+  if(argfd(4, 0, &f) < 0)
     return -1;
-
-  // You can't write back to a file that is not writable
-  if (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
-    return -1;
-
-  // Find an used `vma` struct
-  const int req_pages = length / PGSIZE;
-
-  for (int i = 0; i < NVMA; i++) {
-    // Count how many pages are available that begins at this address
-    int avail_pages = 0;
-    for (int j = 0; j < req_pages && i + j < NVMA; j ++)
-      if (!p->vmas[i + j].used)
-        avail_pages ++;
-
-    if (avail_pages == req_pages) {
-      // Mark used for these VMA structs
-      for (int j = 0; j < req_pages; j ++) {
-        struct vma *a = &p->vmas[i + j];
-        a->used = 1;
-
-        // VM info
-        a->start = VMABASE + PGSIZE * (i + j);
-        a->prot = prot;
-        a->flags = flags;
-        a->mapped = 0;
-
-        // File info
-        a->f = f;
-        a->foffset = PGSIZE * j;
-        filedup(f);
-      }
-      return p->vmas[i].start;
-    }
-  }
-  return -1;
+  argaddr(5, &offset);
+  return vmamap(length, prot, flags, f, offset);
 }
 
-
 uint64
 sys_munmap(void)
 {
-  uint64 va;
-  int length;
-
-  argaddr(0, &va);
-  argint(1, &length);
+  uint64 addr, length;
 
-  // Page-aligned
-  if (PGROUNDDOWN(va) != va)
-    return -1;
-
-  // Page-aligned
-  if (length & 0xfff)
-    return -1;
-
-  int start_ind = (va - VMABASE) / PGSIZE;
-  int end_ind = (va + length - VMABASE) / PGSIZE;  // exclusive
-
-  // Out of bound
-  if (end_ind >= NVMA)
-    return -1;
+  argaddr(0, &addr);
+  argaddr(1, &length);
+  return vmaunmap(addr, length);
+}
 
-  // Check if the requested ranges are in use
-  struct proc *p = myproc();
+uint64
+sys_msync(void)
+{
+  uint64 addr, length;
+  int flags;
 
-  for (int i = start_ind; i < end_ind; i ++)
-    if (!p->vmas[i].used)
-      return -1;
+  argaddr(0, &addr);
+  argaddr(1, &length);
+  argint(2, &flags);
+  return vmamsync(addr, length, flags);
+}
 
-  // Write back the modified part to local file
-  for (int i = start_ind; i < end_ind; i ++)
-    if (filemunmap(i) < 0)
-      return -1;
+uint64
+sys_madvise(void)
+{
+  uint64 addr, length;
+  int advice;
 
-  return 0;
+  argaddr(0, &addr);
+  argaddr(1, &length);
+  argint(2, &advice);
+  return vmamadvise(addr, length, advice);
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,5 @@
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 kmemfree[NCPU];  // free pages in each CPU's kmem partition
 };
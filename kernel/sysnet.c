@@ -25,11 +25,24 @@ struct sock {
 
 static struct spinlock lock;
 static struct sock *sockets;
+static struct kmem_cache *sock_cache;
+
+// Sockets are freed with an empty rxq,
+// so this only needs to run once per object.
+static void
+sockctor(void *obj)
+{
+  struct sock *si = obj;
+
+  initlock(&si->lock, "sock");
+  mbufq_init(&si->rxq);
+}
 
 void
 sockinit(void)
 {
   initlock(&lock, "socktbl");
+  sock_cache = kmem_cache_create("sock", sizeof(struct sock), sockctor);
 }
 
 int
@@ -41,15 +54,13 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
   *f = 0;
   if ((*f = filealloc()) == 0)
     goto bad;
-  if ((si = (struct sock*)kalloc()) == 0)
+  if ((si = (struct sock*)kmem_cache_alloc(sock_cache)) == 0)
     goto bad;
 
-  // initialize objects
+  // initialize objects; the lock and rxq were set up by sockctor()
   si->raddr = raddr;
   si->lport = lport;
   si->rport = rport;
-  initlock(&si->lock, "sock");
-  mbufq_init(&si->rxq);
   (*f)->type = FD_SOCK;
   (*f)->readable = 1;
   (*f)->writable = 1;
@@ -74,7 +85,7 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
 
 bad:
   if (si)
-    kfree((char*)si);
+    kmem_cache_free(sock_cache, si);
   if (*f)
     fileclose(*f);
   return -1;
@@ -104,7 +115,7 @@ sockclose(struct sock *si)
     mbuffree(m);
   }
 
-  kfree((char*)si);
+  kmem_cache_free(sock_cache, si);
 }
 
 int
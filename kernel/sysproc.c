@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sysinfo.h"
+#include "wsinfo.h"
 
 uint64
 sys_exit(void)
@@ -49,6 +50,34 @@ sys_sbrk(void)
   return addr;
 }
 
+uint64
+sys_shmget(void)
+{
+  int key, size;
+
+  argint(0, &key);
+  argint(1, &size);
+  return shmget(key, size);
+}
+
+uint64
+sys_shmat(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmattach(id);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shmdetach(addr);
+}
+
 uint64
 sys_sleep(void)
 {
@@ -118,6 +147,8 @@ sys_sysinfo(void)
 
   kinfo.freemem = mem_freebytes();
   kinfo.nproc = proc_countactive();
+  for(int i = 0; i < NCPU; i++)
+    kinfo.kmemfree[i] = mem_freepages(i);
 
   if(copyout(p->pagetable, userinfo, (char *)&kinfo, sizeof(struct sysinfo)) < 0) {
     return -1;
@@ -153,6 +184,8 @@ sys_sigreturn(void) {
 #endif
 
 #ifdef LAB_PGTBL
+// A bitmask of up to 32 pages, in one unsigned int.
+// pgscan() does any number of pages.
 int
 sys_pgaccess(void)
 {
@@ -166,19 +199,12 @@ sys_pgaccess(void)
   argint(1, &numPages);
   argaddr(2, &uAddr);
 
-  if (numPages > 32) {
+  if (numPages < 0 || numPages > 32) {
     return -1;
   }
 
-  for (int i = 0; i < numPages; i++) {
-    pte_t *pte = walk(p->pagetable, vaddr + i * PGSIZE, 0);
-    if (*pte & PTE_A) {
-      // Page was accessed since the last call
-      abits |= (1 << i);
-      // Clear access bit
-      *pte &= ~PTE_A;
-    }
-  }
+  // Bit i of a little-endian unsigned int is bit i%8 of byte i/8
+  uvmscan(p->pagetable, vaddr, numPages, (uchar *)&abits, 0);
 
   // Copy the kernel results to user addr
   if (copyout(p->pagetable, uAddr, (char *)&abits, sizeof(unsigned int)) < 0) {
@@ -186,4 +212,59 @@ sys_pgaccess(void)
   }
   return 0;
 }
+
+// pgscan(base, npages, abits, dbits): bitmaps of the pages
+// accessed and written since the last scan, (npages+7)/8 bytes
+// each; either may be null.
+uint64
+sys_pgscan(void)
+{
+  uint64 va, uabits, udbits;
+  int npages, n;
+  uchar abits[64], dbits[64];   // a chunk of 512 pages
+  struct proc *p = myproc();
+
+  argaddr(0, &va);
+  argint(1, &npages);
+  argaddr(2, &uabits);
+  argaddr(3, &udbits);
+
+  va = PGROUNDDOWN(va);
+  if (npages < 0 || va >= MAXVA || npages > (MAXVA - va) / PGSIZE)
+    return -1;
+
+  for (int i = 0; i < npages; i += n) {
+    n = npages - i;
+    if (n > 8 * sizeof(abits))
+      n = 8 * sizeof(abits);
+    memset(abits, 0, sizeof(abits));
+    memset(dbits, 0, sizeof(dbits));
+
+    uvmscan(p->pagetable, va + (uint64)i * PGSIZE, n,
+            uabits ? abits : 0, udbits ? dbits : 0);
+
+    if (uabits && copyout(p->pagetable, uabits + i/8, (char *)abits, (n+7)/8) < 0)
+      return -1;
+    if (udbits && copyout(p->pagetable, udbits + i/8, (char *)dbits, (n+7)/8) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_wsinfo(void)
+{
+  int pid;
+  uint64 addr;
+  struct wsinfo wi;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+
+  if (wsget(pid, &wi) < 0)
+    return -1;
+  if (copyout(myproc()->pagetable, addr, (char *)&wi, sizeof(wi)) < 0)
+    return -1;
+  return 0;
+}
 #endif
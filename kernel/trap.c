@@ -65,6 +65,12 @@ usertrap(void)
 
     syscall();
   }
+  else if((r_scause() == SCAUSE_LOADPAGEFAULT
+    || r_scause() == SCAUSE_STOREPAGEFAULT
+    || r_scause() == SCAUSE_INSTPAGEFAULT)
+    && swapin(p->pagetable, r_stval()) == 0) {
+    // The page was swapped out; the access is retried
+  }
   #ifdef LAB_COW
   else if (r_scause() == SCAUSE_STOREPAGEFAULT) {
     // Get faulting address
@@ -73,13 +79,21 @@ usertrap(void)
       setkilled(p);
   }
   #endif
+  #ifdef LAB_LAZY
+  else if (r_scause() == SCAUSE_STOREPAGEFAULT
+    || r_scause() == SCAUSE_LOADPAGEFAULT) {
+    // First touch of a heap page that sbrk() has not backed yet
+    if(uvmlazy(p->pagetable, r_stval()) < 0)
+      setkilled(p);
+  }
+  #endif
   #ifdef LAB_MMAP
   else if (r_scause() == SCAUSE_STOREPAGEFAULT
     || r_scause() == SCAUSE_INSTPAGEFAULT
     || r_scause() == SCAUSE_LOADPAGEFAULT) {
-    // Get faulting address
-    uint64 va = r_stval();
-    if(filemmap(va) < 0)
+    // First touch of a page of an mmap()ed file, or of
+    // the heap since madvise(MADV_DONTNEED)
+    if(vmafault(p->pagetable, r_stval()) < 0)
       setkilled(p);
   }
   #endif
@@ -95,6 +109,11 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
+  #ifdef LAB_PGTBL
+  if(p->wssample)
+    wssample(p);
+  #endif
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2) {
     yield();
@@ -154,7 +173,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = asidsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
@@ -185,8 +204,13 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // the kernel code may be in the middle of using user memory,
+  // which swap must leave alone meanwhile.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->kpreempted = 1;
     yield();
+    myproc()->kpreempted = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -7,6 +7,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
+#include "page.h"
 
 /*
  * the kernel's page table.
@@ -17,6 +18,18 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+#ifdef LAB_COW
+// Serializes decisions about level-0 page-table pages that
+// fork() left shared between processes, see uvmunshare().
+struct spinlock sharelock;
+
+// The zero page. Writable user pages that have not been written
+// yet all map it copy-on-write, and the first write fault gives
+// them a private page. The kernel keeps a reference of its own,
+// so it is never freed.
+static uint64 zeropage;
+#endif
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -63,6 +76,11 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+#ifdef LAB_COW
+  initlock(&sharelock, "sharelock");
+  if((zeropage = (uint64)kalloc_zeroed()) == 0)
+    panic("kvminit: zero page");
+#endif
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -73,7 +91,7 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
@@ -82,6 +100,8 @@ kvminithart()
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
+// If va is covered by a megapage or gigapage, returns
+// that larger leaf PTE instead.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -93,22 +113,53 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the PTE at the given level,
+// where a leaf maps LEVELSIZE(level) bytes.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
+}
+
+// Return the leaf PTE that maps va, at whatever level it is,
+// and store that level in *level.
+// Returns 0 if va is not mapped.
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  if(va >= MAXVA)
+    return 0;
+
+  for(int l = 2; l >= 0; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte) || l == 0) {
+      *level = l;
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
 }
 
 // Look up a virtual address, return the physical address,
@@ -119,29 +170,45 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
-  if(va >= MAXVA)
-    return 0;
-
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  // The 4096-byte page of va within a larger leaf
+  pa = PTE2PA(*pte) + PGROUNDDOWN(va & (LEVELSIZE(level) - 1));
   return pa;
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses the largest leaves that va, pa and sz allow,
+// so the direct map of RAM is mostly megapages.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 end = va + sz;
+  int level;
+
+  if((sz % PGSIZE) != 0)
+    panic("kvmmap: size not aligned");
+
+  while(va < end){
+    for(level = 2; level > 0; level--){
+      uint64 leafsz = LEVELSIZE(level);
+      if(va % leafsz == 0 && pa % leafsz == 0 && end - va >= leafsz)
+        break;
+    }
+    if(mapleaves(kpgtbl, va, LEVELSIZE(level), pa, perm, level) != 0)
+      panic("kvmmap");
+    va += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -152,47 +219,214 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  return mapleaves(pagetable, va, size, pa, perm, 0);
+}
+
+// Like mappages(), but create leaf PTEs at the given level,
+// each mapping LEVELSIZE(level) bytes.
+// va, pa and size MUST be aligned to that size.
+int
+mapleaves(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int level)
+{
+  uint64 a, last, leafsz = LEVELSIZE(level);
   pte_t *pte;
 
-  if((va % PGSIZE) != 0)
+  if((va % leafsz) != 0 || (pa % leafsz) != 0)
     panic("mappages: va not aligned");
 
-  if((size % PGSIZE) != 0)
+  if((size % leafsz) != 0)
     panic("mappages: size not aligned");
 
   if(size == 0)
     panic("mappages: size");
 
-  a = PGROUNDDOWN(va);
-  last = PGROUNDDOWN(va + size - 1);
+  asidstale(pagetable);
+  a = va;
+  last = va + size - leafsz;
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+#ifdef LAB_COW
+    if(level == 0 && uvmunshare(pagetable, a) != 0)
+      return -1;
+#endif
+    if((pte = walklevel(pagetable, a, level, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
     if(a == last)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += leafsz;
+    pa += leafsz;
   }
   return 0;
 }
 
+#ifdef LAB_COW
+// fork() lets parent and child share the level-0 page-table
+// pages of their memory instead of copying them, after making
+// every page in them copy-on-write. A shared page-table page
+// is counted in its frame's refcnt like any other page; it
+// holds one reference on each page it maps, however many
+// processes use it. It must be copied with uvmunshare() before
+// any of its PTEs changes.
+
+// Share the level-0 page-table page that the level-1 PTE pte
+// of the parent points to with page table new, at va.
+// Returns 0 on success, -1 if out of memory.
+static int
+uvmsharetable(pte_t *pte, pagetable_t new, uint64 va)
+{
+  pagetable_t pt = (pagetable_t)PTE2PA(*pte);
+  pte_t *npte;
+
+  if((npte = walklevel(new, va, 1, 1)) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++){
+    if((pt[i] & PTE_V) && (pt[i] & PTE_W)){
+      pt[i] &= ~PTE_W;
+      pt[i] |= PTE_RSW_COW;
+    }
+  }
+  mem_addref((uint64)pt);
+  *npte = *pte;
+  return 0;
+}
+
+// Give pagetable its own copy of the level-0 page-table page
+// that maps va, if that page is shared. The last process to
+// use a shared page keeps it without copying.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmunshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt, npt;
+
+  pte = walklevel(pagetable, va, 1, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return 0;
+  pt = (pagetable_t)PTE2PA(*pte);
+  if(mem_getref((uint64)pt) == 1)
+    return 0;
+
+  if((npt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  acquire(&sharelock);
+  if(mem_getref((uint64)pt) == 1){
+    // The other sharers let go of it meanwhile
+    release(&sharelock);
+    kfree(npt);
+    return 0;
+  }
+  for(int i = 0; i < 512; i++){
+    npt[i] = pt[i];
+    if(pt[i] & PTE_V)
+      mem_addref(PTE2PA(pt[i]));
+    else if(PTE_SWAPPED(pt[i]))
+      swapdup(PTE2SLOT(pt[i]));
+  }
+  mem_dropref((uint64)pt);
+  *pte = PA2PTE(npt) | PTE_V;
+  asidstale(pagetable);
+  release(&sharelock);
+  return 0;
+}
+
+// If the level-0 page-table page that maps va is shared and
+// maps nothing outside [va, end), drop pagetable's reference
+// to it, leaving its pages to the other sharers.
+// Returns 1 if it did so.
+static int
+uvmdropshared(pagetable_t pagetable, uint64 va, uint64 end)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 base = va & ~(MEGAPGSIZE - 1);
+  int dropped = 0;
+
+  pte = walklevel(pagetable, va, 1, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return 0;
+  pt = (pagetable_t)PTE2PA(*pte);
+  if(mem_getref((uint64)pt) == 1)
+    return 0;
+
+  acquire(&sharelock);
+  if(mem_getref((uint64)pt) > 1){
+    dropped = 1;
+    for(int i = 0; i < 512; i++){
+      uint64 a = base + i*PGSIZE;
+      if(pt[i] != 0 && (a < va || a >= end)){
+        dropped = 0;
+        break;
+      }
+    }
+    if(dropped){
+      mem_dropref((uint64)pt);
+      *pte = 0;
+    }
+  }
+  release(&sharelock);
+  return dropped;
+}
+#endif
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+  asidstale(pagetable);
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
+#ifdef LAB_COW
+    if(a == va || a % MEGAPGSIZE == 0){
+      // A page-table page shared since fork() is let go of
+      // whole if possible, and copied if only part of it goes.
+      if(uvmdropshared(pagetable, a, end)){
+        a = PGROUNDDOWN(a | (MEGAPGSIZE - 1));
+        continue;
+      }
+      if(uvmunshare(pagetable, a) != 0)
+        panic("uvmunmap: unshare");
+    }
+#endif
+    pte = walklevel(pagetable, a, 1, 0);
+    if(pte && (*pte & PTE_V) && PTE_LEAF(*pte)){
+      // A megapage: drop it whole if the range covers it,
+      // otherwise split it and go on page by page.
+      if(a % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+        if(do_free){
+          uint64 pa = PTE2PA(*pte);
+          for(int i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+            kfree((void*)(pa + i*PGSIZE));
+        }
+        *pte = 0;
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(uvmsplit(pagetable, a) != 0)
+        panic("uvmunmap: split");
+    }
+    if((pte = walk(pagetable, a, 0)) != 0 && PTE_SWAPPED(*pte)){
+      // Only a swap slot to let go of
+      swapput(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
+#if defined(LAB_LAZY) || defined(LAB_MMAP)
+    // Heap pages, or pages of the program (see vmaimage()),
+    // that were never touched have nothing to unmap
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+#endif
     if((pte = walk(pagetable, a, 0)) == 0)
       panic("uvmunmap: walk");
     if((*pte & PTE_V) == 0) {
@@ -209,16 +443,42 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   }
 }
 
+// Split the megapage that maps va, if there is one, into
+// 512 ordinary PTEs with the same flags, so that its pages
+// can be unmapped, copied or written one at a time.
+// Every frame already has its own reference count.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  uint flags;
+
+  pte = walklevel(pagetable, va, 1, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  asidstale(pagetable);
+  return 0;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -232,31 +492,67 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Aligned 2 MiB stretches get a megapage when the buddy allocator
+// has one, so large heaps need far fewer TLB entries.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
   uint64 a;
+  pte_t *pte;
 
   if(newsz < oldsz)
     return oldsz;
 
+#ifdef LAB_COW
+  // Every PTE on the zero page may need a page of its own once
+  // written: promise no more of them than memory and swap hold.
+  if((xperm & PTE_W) && mem_getref(zeropage) +
+     (PGROUNDUP(newsz) - PGROUNDUP(oldsz)) / PGSIZE >
+     mem_freebytes() / PGSIZE + swapnfree())
+    return 0;
+#endif
+
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    // A page-table page left behind by earlier small pages
+    // keeps being used for small pages.
+    if(a % MEGAPGSIZE == 0 && newsz - a >= MEGAPGSIZE &&
+       ((pte = walklevel(pagetable, a, 1, 0)) == 0 || *pte == 0) &&
+       (mem = kalloc_pages(MEGAPGORDER)) != 0){
+      memset(mem, 0, MEGAPGSIZE);
+      if(mapleaves(pagetable, a, MEGAPGSIZE, (uint64)mem, PTE_R|PTE_U|xperm, 1) == 0){
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      kfree_pages(mem, MEGAPGORDER);
+    }
+
+#ifdef LAB_COW
+    if(xperm & PTE_W){
+      // Zero until written; see uvmunzero()
+      if(mappages(pagetable, a, PGSIZE, zeropage,
+                  PTE_R|PTE_U|PTE_RSW_COW|(xperm & ~PTE_W)) != 0){
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      mem_addref(zeropage);
+      continue;
+    }
+#endif
+
+    mem = kalloc_reclaim(1);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -285,14 +581,14 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 }
 
 // Recursively free page-table pages.
-// All leaf mappings must already have been removed.
+// All leaf mappings, megapages included, must already have been removed.
 void
 freewalk(pagetable_t pagetable)
 {
   // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
+    if((pte & PTE_V) && !PTE_LEAF(pte)){
       // this PTE points to a lower-level page table.
       uint64 child = PTE2PA(pte);
       freewalk((pagetable_t)child);
@@ -314,6 +610,42 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Copy the megapage that pte maps at va into page table new.
+// Returns -1 if it cannot be done with a megapage, in which
+// case the caller splits it and copies it page by page.
+static int
+uvmcopymega(pte_t *pte, pagetable_t new, uint64 va)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint flags;
+
+#ifdef LAB_COW
+  // Shared copy-on-write just like small pages; the first
+  // write fault splits it.
+  if(*pte & PTE_W){
+    *pte &= ~PTE_W;
+    *pte |= PTE_RSW_COW;
+  }
+  flags = PTE_FLAGS(*pte);
+  if(mapleaves(new, va, MEGAPGSIZE, pa, flags, 1) != 0)
+    return -1;
+  for(int i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    mem_addref(pa + i*PGSIZE);
+#else
+  char *mem;
+
+  if((mem = kalloc_pages(MEGAPGORDER)) == 0)
+    return -1;
+  memmove(mem, (char*)pa, MEGAPGSIZE);
+  flags = PTE_FLAGS(*pte);
+  if(mapleaves(new, va, MEGAPGSIZE, (uint64)mem, flags, 1) != 0){
+    kfree_pages(mem, MEGAPGORDER);
+    return -1;
+  }
+#endif
+  return 0;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
@@ -327,7 +659,54 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   uint64 pa, i;
   uint flags;
 
+  // The parent's writable pages become copy-on-write
+  asidstale(old);
+
   for(i = 0; i < sz; i += PGSIZE){
+    pte = walklevel(old, i, 1, 0);
+#ifdef LAB_COW
+    // Share whole page-table pages instead of copying PTEs;
+    // i stays 2 MiB aligned, since every step below covers
+    // a whole 2 MiB range.
+    if(pte && (*pte & PTE_V) && !PTE_LEAF(*pte)){
+      if(uvmsharetable(pte, new, i) != 0)
+        goto err;
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+#endif
+    if(pte && (*pte & PTE_V) && PTE_LEAF(*pte)){
+      if(uvmcopymega(pte, new, i) == 0){
+        i += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(uvmsplit(old, i) != 0)
+        goto err;
+#ifdef LAB_COW
+      // pte now points to a page-table page; share it whole,
+      // so that i stays aligned
+      if(uvmsharetable(pte, new, i) != 0)
+        goto err;
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+#endif
+    }
+
+    if((pte = walk(old, i, 0)) != 0 && PTE_SWAPPED(*pte)){
+      // The child refers to the same swap slot, and gets
+      // its own copy when it swaps the page in
+      pte_t *npte;
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
+#if defined(LAB_LAZY) || defined(LAB_MMAP)
+    // The child faults in untouched heap or program pages itself
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+#endif
     if((pte = walk(old, i, 0)) == 0)
       panic("uvmcopy: pte should exist");
     if((*pte & PTE_V) == 0)
@@ -357,6 +736,16 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
     #else
     char *mem;
 
+    // Program text from the page cache is shared, not copied
+    if((*pte & PTE_W) == 0 && (PA2PAGE(pa)->flags & PG_FILE)){
+      mem_addref(pa);
+      if(mappages(new, i, PGSIZE, pa, PTE_FLAGS(*pte)) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
+
     // Copy parent's physical pages into child
     if((mem = kalloc()) == 0)
       goto err;
@@ -391,6 +780,11 @@ uvmcopy_ondemand(uint64 va) {
   if (va < 0 || va >= MAXVA)
     return -1;
 
+  // Only the faulting page of a megapage is copied, and the
+  // page-table page must be this process's own to change it
+  if (uvmsplit(p->pagetable, va) != 0 || uvmunshare(p->pagetable, va) != 0)
+    return -1;
+
   if ((pte = walk(p->pagetable, va, 0)) == 0)
     return -1;
 
@@ -402,18 +796,35 @@ uvmcopy_ondemand(uint64 va) {
   // Get physical page
   pa = PTE2PA(*pte);
 
-  // Allocate a new page and copy contents
-  new_pa = (uint64)kalloc();
-  if (new_pa == 0)
-    return -1;
-
-  memmove((void*)new_pa, (const void*)pa, PGSIZE);
-
-  // Make the new page writable and clear COW bit
+  // Make the page writable and clear COW bit
   flags = PTE_FLAGS(*pte);
   flags |= PTE_W;
   flags &= ~PTE_RSW_COW;
 
+  // Every other process has already broken its COW share,
+  // so this page can be written in place instead of copied
+  if (mem_getref(pa) == 1) {
+    *pte = PA2PTE(pa) | flags;
+    asidstale(p->pagetable);
+    return 0;
+  }
+
+  // Allocate a new page and copy contents, unless it is the
+  // zero page. Allocating may sleep while pages are swapped out,
+  // this one among them; if its PTE changed meanwhile, the
+  // access faults again.
+  new_pa = (uint64)kalloc_reclaim(pa == zeropage);
+  if (new_pa == 0)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if ((*pte & PTE_V) == 0 || !(*pte & PTE_RSW_COW) || PTE2PA(*pte) != pa) {
+    kfree((void *)new_pa);
+    return 0;
+  }
+
+  if (pa != zeropage)
+    memmove((void*)new_pa, (const void*)pa, PGSIZE);
+
   // Remove the old mapping and install the new mapping
   uvmunmap(p->pagetable, va, 1, 0);
   if(mappages(p->pagetable, va, PGSIZE, (uint64)new_pa, flags) < 0) {
@@ -425,6 +836,72 @@ uvmcopy_ondemand(uint64 va) {
   kfree((void *)pa);
   return 0;
 }
+
+// Give the page at va a private page in place of the zero page,
+// for writers that do not take write faults, like loadseg().
+// Returns the physical address of the page at va, or 0 if
+// it is not mapped or memory ran out.
+uint64
+uvmunzero(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  uint flags;
+  int level;
+
+  if((pte = walkleaf(pagetable, va, &level)) == 0 || level != 0 ||
+     PTE2PA(*pte) != zeropage)
+    return walkaddr(pagetable, va);
+
+  if((mem = kalloc_reclaim(1)) == 0)
+    return 0;
+  if(uvmunshare(pagetable, va) != 0){
+    kfree(mem);
+    return 0;
+  }
+  // The page may have been merged away while kalloc slept
+  pte = walk(pagetable, va, 0);
+  if(PTE2PA(*pte) != zeropage){
+    kfree(mem);
+    return walkaddr(pagetable, va);
+  }
+
+  flags = PTE_FLAGS(*pte);
+  if(flags & PTE_RSW_COW)
+    flags = (flags & ~PTE_RSW_COW) | PTE_W;
+  *pte = PA2PTE(mem) | flags;
+  asidstale(pagetable);
+  kfree((void*)zeropage);
+  return (uint64)mem;
+}
+#endif
+
+#if defined(LAB_LAZY) || defined(LAB_MMAP)
+// Map a zeroed page at va if it lies in the current process's
+// heap but has not been touched since sbrk() grew it, or since
+// madvise(MADV_DONTNEED) gave it back.
+// Returns 0 if it mapped a page, -1 if va is not such a page
+// or memory ran out.
+int
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(pagetable != p->pagetable || va >= p->sz)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) != 0 && *pte != 0)
+    return -1;  // present, e.g. the stack guard page, or swapped out
+  if((mem = kalloc_reclaim(1)) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
 #endif
 
 // mark a PTE invalid for user access.
@@ -433,34 +910,118 @@ void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
+  if(uvmsplit(pagetable, va) != 0)
+    panic("uvmclear: split");
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  asidstale(pagetable);
+}
+
+// The last level-0 page-table page used by a copyin() or
+// copyout(), so the following pages of a long copy are found
+// without walking down from the root again.
+struct walkcache {
+  pagetable_t pagetable;
+  uint64 base;          // first va mapped by pt
+  pagetable_t pt;       // level-0 page-table page, or 0
+};
+
+// Like walkleaf(), but look in wc first, and swap the page
+// in if it is swapped out.
+// Returns 0 unless va has a valid user mapping.
+static pte_t *
+walkcached(struct walkcache *wc, uint64 va, int *level)
+{
+  pte_t *pte;
+
+  if(wc->pt != 0 && (va & ~(MEGAPGSIZE - 1)) == wc->base){
+    pte = &wc->pt[PX(0, va)];
+    *level = 0;
+  } else {
+    wc->pt = 0;
+    if((pte = walkleaf(wc->pagetable, va, level)) == 0)
+      return 0;
+    if(*level == 0){
+      wc->base = va & ~(MEGAPGSIZE - 1);
+      wc->pt = (pagetable_t)PGROUNDDOWN((uint64)pte);
+    }
+  }
+  if(PTE_SWAPPED(*pte)){
+    // Swapping in may replace a shared page-table page
+    wc->pt = 0;
+    if(swapin(wc->pagetable, va) != 0)
+      return 0;
+    return walkcached(wc, va, level);
+  }
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  return pte;
+}
+
+// Bring in whatever of [va, va+len) is not in memory yet: pages
+// that are swapped out, or that are filled in on first touch.
+// For callers that hold spinlocks while they copy to or from
+// user memory, and so must fault the pages in without them
+// when the copy fails.
+// Returns 0 if it brought anything in, so that the copy is
+// worth trying again, -1 if not.
+int
+uvmfaultin(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  uint64 a;
+  int r = -1;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(swapin(pagetable, a) == 0)
+      r = 0;
+#ifdef LAB_LAZY
+    else if(uvmlazy(pagetable, a) == 0)
+      r = 0;
+#endif
+#ifdef LAB_MMAP
+    else if(vmafault(pagetable, a) == 0)
+      r = 0;
+#endif
+  }
+  return r;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Copies up to the end of each leaf at once, so a megapage
+// takes a single memmove().
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
   pte_t *pte;
+  int level;
+  struct walkcache wc = { pagetable, 0, 0 };
 
   while(len > 0){
-    va0 = PGROUNDDOWN(dstva);
-    if (va0 >= MAXVA)
-      return -1;
-
-    if((pte = walk(pagetable, va0, 0)) == 0)
+    pte = walkcached(&wc, dstva, &level);
+#ifdef LAB_LAZY
+    if(pte == 0 && uvmlazy(pagetable, dstva) == 0)
+      pte = walkcached(&wc, dstva, &level);
+#endif
+#ifdef LAB_MMAP
+    if(pte == 0 && vmafault(pagetable, dstva) == 0)
+      pte = walkcached(&wc, dstva, &level);
+#endif
+    if(pte == 0)
       return -1;
 
     #ifdef LAB_COW
     if (*pte & PTE_RSW_COW) {
-      if (uvmcopy_ondemand(va0) < 0)
+      if (uvmcopy_ondemand(dstva) < 0)
         return -1;
-      // pte = walk(pagetable, va0, 0);
+      // The fault may have split a megapage under pte, or
+      // left the page swapped out; look again
+      wc.pt = 0;
+      continue;
     }
     #endif
 
@@ -468,18 +1029,18 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     if((*pte & PTE_W) == 0)
       return -1;
 
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-
-    n = PGSIZE - (dstva - va0);
+    va0 = dstva & ~(LEVELSIZE(level) - 1);
+    pa0 = PTE2PA(*pte);
+    n = LEVELSIZE(level) - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    // The hardware only marks pages that user code writes
+    __atomic_fetch_or(pte, PTE_D, __ATOMIC_RELAXED);
 
     len -= n;
     src += n;
-    dstva = va0 + PGSIZE;
+    dstva = va0 + LEVELSIZE(level);
   }
   return 0;
 }
@@ -491,19 +1052,32 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int level;
+  struct walkcache wc = { pagetable, 0, 0 };
+
   while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pte = walkcached(&wc, srcva, &level);
+#ifdef LAB_LAZY
+    if(pte == 0 && uvmlazy(pagetable, srcva) == 0)
+      pte = walkcached(&wc, srcva, &level);
+#endif
+#ifdef LAB_MMAP
+    if(pte == 0 && vmafault(pagetable, srcva) == 0)
+      pte = walkcached(&wc, srcva, &level);
+#endif
+    if(pte == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
+    va0 = srcva & ~(LEVELSIZE(level) - 1);
+    pa0 = PTE2PA(*pte);
+    n = LEVELSIZE(level) - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
 
     len -= n;
     dst += n;
-    srcva = va0 + PGSIZE;
+    srcva = va0 + LEVELSIZE(level);
   }
   return 0;
 }
@@ -517,13 +1091,25 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  pte_t *pte;
+  int level;
+  struct walkcache wc = { pagetable, 0, 0 };
 
   while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pte = walkcached(&wc, srcva, &level);
+#ifdef LAB_LAZY
+    if(pte == 0 && uvmlazy(pagetable, srcva) == 0)
+      pte = walkcached(&wc, srcva, &level);
+#endif
+#ifdef LAB_MMAP
+    if(pte == 0 && vmafault(pagetable, srcva) == 0)
+      pte = walkcached(&wc, srcva, &level);
+#endif
+    if(pte == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
+    va0 = srcva & ~(LEVELSIZE(level) - 1);
+    pa0 = PTE2PA(*pte);
+    n = LEVELSIZE(level) - (srcva - va0);
     if(n > max)
       n = max;
 
@@ -542,7 +1128,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       dst++;
     }
 
-    srcva = va0 + PGSIZE;
+    srcva = va0 + LEVELSIZE(level);
   }
   if(got_null){
     return 0;
@@ -551,6 +1137,93 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+#ifdef LAB_PGTBL
+// Working-set scanning.
+//
+// The hardware sets PTE_A and PTE_D in a leaf when the page is
+// accessed or written. pgaccess() and pgscan() report and clear
+// them. The sampler in wset.c clears PTE_A once per interval as
+// well, but moves it into PTE_SWA, so pgscan() still sees every
+// access since its own last call.
+//
+// PTEs are cleared with atomics: the hardware sets PTE_A and
+// PTE_D concurrently, and a plain read-modify-write could
+// lose those updates.
+
+// Set bit i of abits (dbits) if the i'th page from va was
+// accessed (written) since the last scan, and clear what was
+// reported. Either bitmap may be 0. Bit i is bit i%8 of byte
+// i/8; the caller zeroes the bitmaps. Pages that are not
+// mapped are reported as neither. A megapage has one set of
+// bits, which counts for all of its pages.
+void
+uvmscan(pagetable_t pagetable, uint64 va, int npages, uchar *abits, uchar *dbits)
+{
+  uint64 a, next, end, i;
+  pte_t *pte;
+  pte_t old, clear;
+  int level;
+
+  clear = (abits ? PTE_A|PTE_SWA : 0) | (dbits ? PTE_D : 0);
+  va = PGROUNDDOWN(va);
+  end = va + (uint64)npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((pte = walkleaf(pagetable, a, &level)) == 0){
+      next = a + PGSIZE;
+      continue;
+    }
+    next = (a & ~(LEVELSIZE(level) - 1)) + LEVELSIZE(level);
+    if((*pte & PTE_U) == 0)
+      continue;
+
+    old = __atomic_fetch_and(pte, ~clear, __ATOMIC_RELAXED);
+    for(i = (a - va) / PGSIZE; i < npages && va + i*PGSIZE < next; i++){
+      if(abits && (old & (PTE_A|PTE_SWA)))
+        abits[i/8] |= 1 << (i%8);
+      if(dbits && (old & PTE_D))
+        dbits[i/8] |= 1 << (i%8);
+    }
+  }
+
+  // Cached entries still have the bits set, and the hardware
+  // would not set them again
+  asidstale(pagetable);
+}
+
+// For the working-set sampler: count the mapped user pages
+// below sz that were accessed since the last sample (*hot) and
+// those that were not (*cold), and start a new interval.
+void
+uvmsample(pagetable_t pagetable, uint64 sz, uint64 *hot, uint64 *cold)
+{
+  uint64 a, next, n;
+  pte_t *pte;
+  pte_t old;
+  int level;
+
+  *hot = *cold = 0;
+  for(a = 0; a < sz; a = next){
+    if((pte = walkleaf(pagetable, a, &level)) == 0){
+      next = a + PGSIZE;
+      continue;
+    }
+    next = (a & ~(LEVELSIZE(level) - 1)) + LEVELSIZE(level);
+    if((*pte & PTE_U) == 0)
+      continue;
+
+    n = ((next < sz ? next : PGROUNDUP(sz)) - a) / PGSIZE;
+    old = __atomic_fetch_and(pte, ~PTE_A, __ATOMIC_RELAXED);
+    if(old & PTE_A){
+      __atomic_fetch_or(pte, PTE_SWA, __ATOMIC_RELAXED);
+      *hot += n;
+    } else {
+      *cold += n;
+    }
+  }
+  asidstale(pagetable);
+}
+#endif
+
 static void
 vmprint_walk(pagetable_t pagetable, int level) {
   if (level == 0)
@@ -566,6 +1239,11 @@ vmprint_walk(pagetable_t pagetable, int level) {
           printf(" ");
       }
       uint64 child = PTE2PA(*pte);
+      if (level > 1 && PTE_LEAF(*pte)) {
+        // A megapage or gigapage; there is no next level
+        printf("%d: pte %p pa %p (%s)\n", i, *pte, child, level == 3 ? "1G" : "2M");
+        continue;
+      }
       printf("%d: pte %p pa %p\n", i, *pte, child);
 
       // Go down the next level
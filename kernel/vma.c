@@ -0,0 +1,665 @@
+// Memory-mapped files.
+//
+// mmap() reserves a range of the caller's address space between
+// VMABASE and SHMBASE for part of a file, and records it as a
+// struct vma in p->vmas, which is kept sorted by address so a
+// fault finds its range with a binary search. Nothing is read
+// until a page is first touched: vmafault() then maps the page.
+//
+// A MAP_SHARED mapping maps the file's pages in the page cache
+// (see pcache.c), so all processes that map a file, and read()
+// and write() on it, see the same data. If it may be written,
+// the pages written since (PTE_D) are written back to the file
+// by msync() and when they are unmapped, up to the end of the
+// file; mappings never make a file longer. A MAP_PRIVATE
+// mapping gets copies of its own, and is never written back,
+// unless it cannot be written: then it maps the cached pages
+// too.
+//
+// A fault on a cached page also maps the pages around it that
+// are in the cache already, up to FAULTAROUND of them, so that
+// they need no faults of their own. When faults move through a
+// range in order, the page cache reads RAPAGES more ahead of
+// them in the background (see pcachereadahead()).
+//
+// munmap() may take any page-aligned part of a range: the range
+// shrinks from either end, or splits in two if the middle goes.
+//
+// exec() records the whole pages of file data in a program's
+// segments as VMA_IMAGE ranges, instead of reading them all in,
+// so that a program only reads the parts of itself it runs.
+// They are MAP_PRIVATE: read-only text maps the cached pages,
+// marked PG_TEXT, and so is shared by all processes running the
+// program, while data gets copies. But they lie below p->sz:
+// uvmcopy() and uvmfree() look after their pages, munmap() leaves
+// them alone, and vmafork() and vmaexit() only pass on the file.
+// Only the process itself looks at its ranges, so they need
+// no lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Dirty pages written back per log transaction. Mapped pages lie
+// within the file, so writing them allocates no blocks: a page
+// takes PGSIZE/BSIZE data blocks, and the inode one more.
+#define WBPAGES ((MAXOPBLOCKS-1) / (PGSIZE/BSIZE))
+
+#define FAULTAROUND 16   // pages mapped by one fault, at most
+#define RAPAGES     32   // pages read ahead of an in-order scan
+
+// Counted without a lock; for statistics only
+struct {
+  int faults;
+  int avoided;     // pages mapped around a fault
+} vmastat;
+
+// Whether v maps the page cache's pages, rather than copies.
+static int
+vmacached(struct vma *v)
+{
+  return (v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE);
+}
+
+// Returns the range of p that holds va, or 0.
+static struct vma *
+vmafind(struct proc *p, uint64 va)
+{
+  int lo = 0, hi = p->nvma;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    struct vma *v = &p->vmas[mid];
+    if(va < v->start)
+      hi = mid;
+    else if(va >= v->end)
+      lo = mid + 1;
+    else
+      return v;
+  }
+  return 0;
+}
+
+// Make room for a range at index i of p->vmas.
+// Caller has checked that p->nvma < NVMA.
+static struct vma *
+vmainsert(struct proc *p, int i)
+{
+  for(int j = p->nvma; j > i; j--)
+    p->vmas[j] = p->vmas[j-1];
+  p->nvma++;
+  return &p->vmas[i];
+}
+
+// Count n more VMA_IMAGE ranges like v in its inode's ntext.
+static void
+vmatext(struct vma *v, int n)
+{
+  if(v->flags & VMA_IMAGE)
+    __sync_fetch_and_add(&v->f->ip->ntext, n);
+}
+
+// Split range i of p at a, which lies inside it: the part
+// from a on becomes range i+1.
+// Caller has checked that p->nvma < NVMA.
+static void
+vmasplit(struct proc *p, int i, uint64 a)
+{
+  struct vma *v, *w;
+
+  w = vmainsert(p, i + 1);
+  v = &p->vmas[i];
+  *w = *v;
+  w->start = a;
+  w->off += a - v->start;
+  filedup(w->f);
+  vmatext(w, 1);
+  v->end = a;
+}
+
+static void
+vmaremove(struct proc *p, int i)
+{
+  p->nvma--;
+  for(int j = i; j < p->nvma; j++)
+    p->vmas[j] = p->vmas[j+1];
+}
+
+// PTE permissions for prot. RISC-V has no write-only pages.
+static int
+vmaperm(int prot)
+{
+  int perm = PTE_U;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Map len bytes of f, from offset off on, into the current
+// process at an address the kernel picks.
+// Returns the address, or -1.
+uint64
+vmamap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 start;
+  int i;
+
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  // Written back to a file that may not be written
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  if(len == 0 || off % PGSIZE != 0 || off > MAXFILE*BSIZE ||
+     len > MAXFILE*BSIZE - off)
+    return -1;
+  if(p->nvma == NVMA)
+    return -1;
+  len = PGROUNDUP(len);
+
+  // The first gap that is big enough
+  start = VMABASE;
+  for(i = 0; i < p->nvma; i++){
+    if(p->vmas[i].flags & VMA_IMAGE)
+      continue;
+    if(p->vmas[i].start - start >= len)
+      break;
+    start = p->vmas[i].end;
+  }
+  if(start + len > SHMBASE)
+    return -1;
+
+  v = vmainsert(p, i);
+  v->start = start;
+  v->end = start + len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  v->lastfault = v->raend = 0;
+  v->advice = MADV_NORMAL;
+  return start;
+}
+
+// Record [start, end) of p's program, which exec() has just
+// loaded, as mapping f from offset off on, to be read in as
+// it is touched. The range gets a reference to f of its own,
+// and takes over the count in its inode's ntext that exec()
+// took while it read the program.
+// Returns 0, or -1 if p->vmas is full.
+int
+vmaimage(struct proc *p, uint64 start, uint64 end, int prot,
+         struct file *f, uint64 off)
+{
+  struct vma *v;
+  int i;
+
+  if(p->nvma == NVMA)
+    return -1;
+  for(i = 0; i < p->nvma; i++)
+    if(start < p->vmas[i].start)
+      break;
+  v = vmainsert(p, i);
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->flags = MAP_PRIVATE | VMA_IMAGE;
+  v->f = filedup(f);
+  v->off = off;
+  v->lastfault = v->raend = 0;
+  v->advice = MADV_NORMAL;
+  return 0;
+}
+
+// Write the pages of [a, b) that v maps in p and that were
+// written since, back to the file, WBPAGES to a transaction.
+// Clears their PTE_D.
+static void
+vmasync(struct proc *p, struct vma *v, uint64 a, uint64 b)
+{
+  struct inode *ip = v->f->ip;
+  pte_t *pte;
+  uint off, n;
+  int batch = 0;
+
+  if(!(v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))
+    return;
+
+  for(uint64 va = a; va < b; va += PGSIZE){
+    if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0 ||
+       (*pte & PTE_D) == 0)
+      continue;
+    // Cleared first, and the TLB entry with it, so that
+    // a write after this one marks the page again
+    __atomic_fetch_and(pte, ~PTE_D, __ATOMIC_RELAXED);
+    asidstale(p->pagetable);
+
+    if(batch == 0)
+      begin_op();
+    off = v->off + (va - v->start);
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    if(++batch == WBPAGES){
+      end_op();
+      batch = 0;
+    }
+  }
+  if(batch)
+    end_op();
+}
+
+// Unmap the pages of [a, b) that v maps in p, writing
+// back those that were written first if writeback is set.
+static void
+vmaunmappages(struct proc *p, struct vma *v, uint64 a, uint64 b, int writeback)
+{
+  pte_t *pte;
+
+  if(writeback)
+    vmasync(p, v, a, b);
+  for(uint64 va = a; va < b; va += PGSIZE){
+    if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    uvmunmap(p->pagetable, va, 1, 1);
+  }
+}
+
+// Write back whatever the current process wrote to shared
+// mappings in [addr, addr+len) since it was last written back.
+// Writes are synchronous, so flags only has to be valid.
+// Returns 0, or -1 if part of the range is not mapped.
+int
+vmamsync(uint64 addr, uint64 len, int flags)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, b, end;
+
+  if(addr % PGSIZE != 0 || addr + len < addr ||
+     (flags & ~(MS_ASYNC|MS_INVALIDATE|MS_SYNC)) != 0 ||
+     (flags & (MS_ASYNC|MS_SYNC)) == (MS_ASYNC|MS_SYNC))
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(a = addr; a < end; a = b){
+    if((v = vmafind(p, a)) == 0)
+      return -1;
+    b = end < v->end ? end : v->end;
+    vmasync(p, v, a, b);
+  }
+  return 0;
+}
+
+// Give back the pages of [a, b) of p's memory below p->sz, for
+// MADV_DONTNEED: the next touch finds a zeroed page, or reads
+// the program in again. The stack guard page stays.
+static void
+vmadontneed(struct proc *p, uint64 a, uint64 b)
+{
+  pte_t *pte;
+
+  for(; a < b; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || *pte == 0 || (*pte & PTE_U) == 0)
+      continue;
+    uvmunmap(p->pagetable, a, 1, 1);
+  }
+}
+
+// Take advice on how the current process will use
+// [addr, addr+len), which may span its memory below p->sz and
+// mapped files. MADV_RANDOM and MADV_SEQUENTIAL turn readahead
+// off or on for good for the file ranges, and MADV_NORMAL
+// back to spotting faults in order. MADV_WILLNEED asks the page
+// cache to read the files in the background, and swaps the
+// rest in. MADV_DONTNEED frees the pages, writing back what
+// shared mappings wrote first.
+// Returns 0, or -1 if part of the range is not mapped, or a
+// range would have to split and p->vmas is full.
+int
+vmamadvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, b, end, sz = PGROUNDUP(p->sz);
+  int i, nsplit = 0;
+
+  if(addr % PGSIZE != 0 || addr + len < addr ||
+     advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(a = addr; a < end; a = b){
+    if(a < sz)
+      b = sz;
+    else if((v = vmafind(p, a)) != 0)
+      b = v->end;
+    else
+      return -1;
+  }
+
+  if(advice == MADV_NORMAL || advice == MADV_RANDOM ||
+     advice == MADV_SEQUENTIAL){
+    // Only the advised part of a range takes the advice
+    for(i = 0; i < p->nvma; i++){
+      v = &p->vmas[i];
+      nsplit += v->start < addr && addr < v->end;
+      nsplit += v->start < end && end < v->end;
+    }
+    if(p->nvma + nsplit > NVMA)
+      return -1;
+    for(i = 0; i < p->nvma; i++){
+      v = &p->vmas[i];
+      if(v->end <= addr || end <= v->start)
+        continue;
+      if(v->start < addr){
+        vmasplit(p, i, addr);
+        continue;   // the advised part is next
+      }
+      if(end < v->end)
+        vmasplit(p, i, end);
+      v->advice = advice;
+      v->lastfault = v->raend = 0;
+    }
+    return 0;
+  }
+
+  if(addr < sz){
+    b = end < sz ? end : sz;
+    if(advice == MADV_DONTNEED)
+      vmadontneed(p, addr, b);
+    else
+      swapinrange(p->pagetable, addr, b - addr);
+  }
+  for(i = 0; i < p->nvma; i++){
+    v = &p->vmas[i];
+    if(v->end <= addr || end <= v->start)
+      continue;
+    a = addr > v->start ? addr : v->start;
+    b = end < v->end ? end : v->end;
+    if(advice == MADV_WILLNEED)
+      pcachereadahead(v->f->ip, v->off + (a - v->start), (b - a) / PGSIZE);
+    else if(!(v->flags & VMA_IMAGE))
+      vmaunmappages(p, v, a, b, 1);
+  }
+  return 0;
+}
+
+// Unmap [addr, addr+len) from the current process. Parts of
+// the range that are not mapped are left alone.
+// Returns 0, or -1 if a range would have to split and
+// p->vmas is full.
+int
+vmaunmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, b, end;
+  int i;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  if(p->nvma == NVMA){
+    for(i = 0; i < p->nvma; i++){
+      v = &p->vmas[i];
+      if(!(v->flags & VMA_IMAGE) && v->start < addr && end < v->end)
+        return -1;
+    }
+  }
+
+  for(i = 0; i < p->nvma; ){
+    v = &p->vmas[i];
+    if(v->end <= addr || end <= v->start || (v->flags & VMA_IMAGE)){
+      i++;
+      continue;
+    }
+    a = addr > v->start ? addr : v->start;
+    b = end < v->end ? end : v->end;
+    vmaunmappages(p, v, a, b, 1);
+
+    if(a == v->start && b == v->end){
+      fileclose(v->f);
+      vmaremove(p, i);
+      continue;
+    }
+    if(a == v->start){
+      v->off += b - v->start;
+      v->start = b;
+    } else if(b == v->end){
+      v->end = a;
+    } else {
+      // The middle goes; the top becomes a range of its own
+      vmasplit(p, i, b);
+      v->end = a;
+    }
+    i++;
+  }
+  return 0;
+}
+
+// Map the pages in the FAULTAROUND-aligned window around va
+// that are not mapped yet but are in the page cache.
+static void
+vmaaround(struct proc *p, struct vma *v, uint64 va, int perm)
+{
+  uint64 win = FAULTAROUND*PGSIZE;
+  uint64 a = va - va % win, b = a + win, pa;
+  pte_t *pte;
+
+  if(a < v->start)
+    a = v->start;
+  if(b > v->end)
+    b = v->end;
+  for(; a < b; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) != 0 && *pte != 0)
+      continue;
+    if((pa = pcachelookup(v->f->ip, v->off + (a - v->start))) == 0)
+      continue;
+    if(v->flags & VMA_IMAGE)
+      pcachetext(pa);
+    if(mappages(p->pagetable, a, PGSIZE, pa, perm) != 0){
+      kfree((void*)pa);
+      return;
+    }
+    __sync_fetch_and_add(&vmastat.avoided, 1);
+  }
+}
+
+// Start reading ahead of a fault at va if faults in v
+// have been going through it in order.
+static void
+vmareadahead(struct vma *v, uint64 va)
+{
+  uint64 win = FAULTAROUND*PGSIZE;
+  uint64 a, b;
+  int seq = v->advice == MADV_SEQUENTIAL ||
+            (va > v->lastfault && va - v->lastfault <= win);
+
+  v->lastfault = va;
+  if(!seq || v->advice == MADV_RANDOM)
+    return;
+  // From the end of this fault's window, or of what was
+  // read ahead already
+  a = va - va % win + win;
+  if(a < v->raend)
+    a = v->raend;
+  b = va - va % win + win + RAPAGES*PGSIZE;
+  if(b > v->end)
+    b = v->end;
+  if(a >= b)
+    return;
+  pcachereadahead(v->f->ip, v->off + (a - v->start), (b - a) / PGSIZE);
+  v->raend = b;
+}
+
+// Read the page at va in from the file that maps it, or map a
+// zeroed one if it is heap that madvise() gave back, for a page
+// fault, or copyin() or copyout(). pagetable must be the current
+// process's.
+// Returns 0, or -1 if va is in neither, the access is not
+// allowed, or the caller holds spinlocks and may not wait for
+// the disk.
+int
+vmafault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 pa;
+  uint off;
+  int perm;
+
+  if(pagetable != p->pagetable)
+    return -1;
+  if((v = vmafind(p, va)) == 0)
+    return uvmlazy(pagetable, va);
+  // sbrk() gave back this part of the program
+  if((v->flags & VMA_IMAGE) && va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  // Mapped already, so the access was not allowed, or
+  // swapped out and swapin() could not bring it back
+  if((pte = walk(pagetable, va, 0)) != 0 && *pte != 0)
+    return -1;
+  if(((perm = vmaperm(v->prot)) & (PTE_R|PTE_X)) == 0 || !maysleep())
+    return -1;
+  ip = v->f->ip;
+  off = v->off + (va - v->start);
+  // read() or write() on the same file, into or from its mapping
+  if(holdingsleep(&ip->lock))
+    return -1;
+
+  __sync_fetch_and_add(&vmastat.faults, 1);
+  ilock(ip);
+  if(vmacached(v)){
+    if((pa = pcacheget(ip, off)) != 0 && (v->flags & VMA_IMAGE))
+      pcachetext(pa);
+  } else if((pa = (uint64)kalloc_reclaim(1)) != 0){
+    // Past the end of the file reads as zeros
+    if(readi(ip, 0, pa, off, PGSIZE) < 0){
+      kfree((void*)pa);
+      pa = 0;
+    }
+  }
+  iunlock(ip);
+  if(pa == 0)
+    return -1;
+
+  if(mappages(pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  if(vmacached(v)){
+    vmaaround(p, v, va, perm);
+    vmareadahead(v, va);
+  }
+  return 0;
+}
+
+// Give child np the ranges of p. Pages that p has read in
+// are shared with np if they are in the page cache, and
+// copied if not.
+// Returns 0, or -1 if memory ran out, leaving np with none.
+// Caller holds np->lock.
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 va, pa;
+  char *mem;
+
+  for(int i = 0; i < p->nvma; i++){
+    v = &np->vmas[i];
+    *v = p->vmas[i];
+    filedup(v->f);
+    vmatext(v, 1);
+    np->nvma++;
+    if(v->flags & VMA_IMAGE)
+      continue;   // uvmcopy() copied its pages
+
+    for(va = v->start; va < v->end; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if(!vmacached(v)){
+        if((mem = kalloc()) == 0)
+          goto bad;
+        memmove(mem, (char*)pa, PGSIZE);
+        pa = (uint64)mem;
+      } else {
+        mem_addref(pa);
+      }
+      // The parent writes back what it wrote
+      if(mappages(np->pagetable, va, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_D) != 0){
+        kfree((void*)pa);
+        goto bad;
+      }
+    }
+  }
+  return 0;
+
+bad:
+  // p holds the same files, so closing them cannot sleep,
+  // and has the shared pages to write back itself
+  for(int i = 0; i < np->nvma; i++){
+    v = &np->vmas[i];
+    if(!(v->flags & VMA_IMAGE))
+      vmaunmappages(np, v, v->start, v->end, 0);
+    vmatext(v, -1);
+    fileclose(v->f);
+  }
+  np->nvma = 0;
+  return -1;
+}
+
+// Unmap all of p's ranges, for exec() and exit(). The pages
+// of VMA_IMAGE ranges go with the rest of p's memory.
+void
+vmaexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(int i = 0; i < p->nvma; i++){
+    v = &p->vmas[i];
+    if(!(v->flags & VMA_IMAGE))
+      vmaunmappages(p, v, v->start, v->end, 1);
+    vmatext(v, -1);
+    fileclose(v->f);
+  }
+  p->nvma = 0;
+}
+
+// Report mapped-file faults for the statistics device.
+int
+statsvma(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "--- mapped files\n");
+  n += snprintf(buf+n, sz-n, "faults: %d\n", vmastat.faults);
+  n += snprintf(buf+n, sz-n, "faults avoided: %d\n", vmastat.avoided);
+  return n;
+}
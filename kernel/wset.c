@@ -0,0 +1,93 @@
+// Working-set sampler.
+//
+// The wsetd kernel thread wakes up every WS_INTERVAL ticks and
+// asks each user process for a sample of its page table: how
+// many of its pages were accessed since the previous sample
+// (hot) and how many were not (cold). wsinfo() reads the
+// latest sample, for deciding which memory is worth keeping
+// close and which could go to a slower tier.
+//
+// A process takes the sample itself, in usertrap(), the next
+// time it enters the kernel. Only the process changes its own
+// page table, so the walk needs no locking against it; and a
+// process that is not running cannot have touched any pages.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "wsinfo.h"
+
+extern struct proc proc[NPROC];
+
+static void
+wsetd(void)
+{
+  struct proc *p;
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < WS_INTERVAL)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(p = proc; p < &proc[NPROC]; p++){
+      acquire(&p->lock);
+      if(p->state != UNUSED && p->kthread == 0)
+        p->wssample = 1;
+      release(&p->lock);
+    }
+  }
+}
+
+void
+wsetinit(void)
+{
+  if(WS_INTERVAL == 0)
+    return;
+  if(kthread_create("wsetd", wsetd) < 0)
+    panic("wsetinit");
+}
+
+// Take the sample wsetd asked p for.
+// Called by p, from usertrap().
+void
+wssample(struct proc *p)
+{
+  uint64 hot, cold;
+
+  uvmsample(p->pagetable, p->sz, &hot, &cold);
+
+  acquire(&p->lock);
+  p->wssample = 0;
+  p->wshot = hot;
+  p->wscold = cold;
+  p->wssamples++;
+  release(&p->lock);
+}
+
+// Fill in *wi with the latest sample of process pid.
+// Returns -1 if there is no such process.
+int
+wsget(int pid, struct wsinfo *wi)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->kthread == 0){
+      wi->hot = p->wshot;
+      wi->cold = p->wscold;
+      wi->samples = p->wssamples;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
@@ -0,0 +1,5 @@
+struct wsinfo {
+  uint64 hot;       // pages accessed in the last sampling interval
+  uint64 cold;      // mapped pages not accessed in it
+  uint64 samples;   // number of samples taken so far
+};
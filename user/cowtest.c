@@ -177,6 +177,103 @@ filetest()
   printf("ok\n");
 }
 
+// untouched heap pages all read as zero, and a write to
+// one of them must not show up in any other.
+void
+zerotest()
+{
+  int npages = 256;
+  char *p = sbrk(0);
+
+  printf("zero: ");
+
+  // one page at a time, so that no megapages are used
+  for(int i = 0; i < npages; i++){
+    if(sbrk(4096) == (char*)0xffffffffffffffffL){
+      printf("sbrk failed\n");
+      exit(-1);
+    }
+  }
+  for(int i = 0; i < npages * 4096; i += 512){
+    if(p[i] != 0){
+      printf("fresh heap page not zero\n");
+      exit(-1);
+    }
+  }
+
+  for(int i = 0; i < npages; i += 2)
+    p[i * 4096 + 100] = 'z';
+  for(int i = 0; i < npages; i++){
+    if(p[i * 4096 + 100] != (i % 2 == 0 ? 'z' : 0) || p[i * 4096] != 0){
+      printf("write to a zero page went astray\n");
+      exit(-1);
+    }
+  }
+
+  sbrk(-npages * 4096);
+  printf("ok\n");
+}
+
+// return the number after "name: " in the statistics device.
+int
+statvalue(char *name)
+{
+  static char buf[1024];
+  int n = strlen(name), len;
+
+  if((len = statistics(buf, sizeof(buf) - 1)) <= 0)
+    return -1;
+  buf[len] = 0;
+  for(char *s = buf; *s; s++){
+    if(memcmp(s, name, n) == 0 && s[n] == ':')
+      return atoi(s + n + 2);
+  }
+  return -1;
+}
+
+// identical pages get merged by the kernel in the background;
+// writes must still split them again.
+void
+mergetest()
+{
+  int npages = 32;
+  int saved;
+
+  printf("merge: ");
+
+  char *p = sbrk(npages * 4096);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", npages * 4096);
+    exit(-1);
+  }
+  memset(p, 'm', npages * 4096);
+
+  saved = statvalue("pages saved");
+  if(saved < 0){
+    printf("no merging statistics\n");
+    exit(-1);
+  }
+  // give the scanner a few rounds to find the pages
+  for(int i = 0; i < 20 && statvalue("pages saved") < saved + npages/2; i++)
+    sleep(10);
+  if(statvalue("pages saved") < saved + npages/2){
+    printf("identical pages were not merged\n");
+    exit(-1);
+  }
+
+  for(int i = 0; i < npages; i++)
+    p[i * 4096] = i;
+  for(int i = 0; i < npages; i++){
+    if(p[i * 4096] != i || p[i * 4096 + 1] != 'm'){
+      printf("write to a merged page went astray\n");
+      exit(-1);
+    }
+  }
+
+  sbrk(-npages * 4096);
+  printf("ok\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -191,6 +288,9 @@ main(int argc, char *argv[])
 
   filetest();
 
+  zerotest();
+  mergetest();
+
   printf("ALL COW TESTS PASSED\n");
 
   exit(0);
@@ -0,0 +1,166 @@
+//
+// tests for lazy (demand-zero) sbrk.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define REGION_SZ (1024 * 1024 * 1024)
+
+// grow the heap far beyond physical memory, but only
+// touch a few pages. this fails if sbrk() allocates eagerly.
+void
+sparsetest()
+{
+  char *p;
+
+  printf("sparse: ");
+
+  p = sbrk(REGION_SZ);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", REGION_SZ);
+    exit(-1);
+  }
+
+  for(char *q = p; q < p + REGION_SZ; q += 64 * 1024 * 1024){
+    if(*(int*)q != 0){
+      printf("lazy page not zeroed\n");
+      exit(-1);
+    }
+    *(int*)q = 0xbeef;
+  }
+  for(char *q = p; q < p + REGION_SZ; q += 64 * 1024 * 1024){
+    if(*(int*)q != 0xbeef){
+      printf("lazy page lost its contents\n");
+      exit(-1);
+    }
+  }
+
+  if(sbrk(-REGION_SZ) == (char*)0xffffffffffffffffL){
+    printf("sbrk(-%d) failed\n", REGION_SZ);
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
+// a child shares the parent's untouched heap pages,
+// and faults in its own.
+void
+forktest()
+{
+  char *p;
+  int pid, xstatus;
+
+  printf("fork: ");
+
+  p = sbrk(4 * 4096);
+  p[0] = 'p';
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    if(p[0] != 'p' || p[4096] != 0)
+      exit(1);
+    p[2 * 4096] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("child saw wrong heap contents\n");
+    exit(-1);
+  }
+  if(p[2 * 4096] != 0){
+    printf("child's write reached the parent\n");
+    exit(-1);
+  }
+
+  sbrk(-4 * 4096);
+  printf("ok\n");
+}
+
+// system calls read and write untouched heap pages,
+// through copyin() and copyout().
+void
+syscalltest()
+{
+  char *p;
+  int fds[2];
+
+  printf("syscall: ");
+
+  p = sbrk(3 * 4096);
+  if(pipe(fds) < 0){
+    printf("pipe failed\n");
+    exit(-1);
+  }
+
+  // copyin from a page nobody has touched
+  if(write(fds[1], p + 4096, 16) != 16){
+    printf("write from lazy page failed\n");
+    exit(-1);
+  }
+  // copyout into a page nobody has touched
+  if(read(fds[0], p + 2 * 4096, 16) != 16){
+    printf("read into lazy page failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < 16; i++){
+    if(p[2 * 4096 + i] != 0){
+      printf("wrong data read back\n");
+      exit(-1);
+    }
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-3 * 4096);
+  printf("ok\n");
+}
+
+// touching memory above the heap must still kill the process.
+void
+outofrangetest()
+{
+  int pid, xstatus;
+
+  printf("out of range: ");
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    char *top = sbrk(0);
+    *(top + 4096) = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("write above sbrk(0) was not killed\n");
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  sparsetest();
+
+  // check that the first sparsetest() unmapped what it touched.
+  sparsetest();
+
+  forktest();
+  syscalltest();
+  outofrangetest();
+
+  printf("ALL LAZY TESTS PASSED\n");
+
+  exit(0);
+}
@@ -8,6 +8,11 @@
 
 void mmap_test();
 void fork_test();
+void range_test();
+void coherence_test();
+void msync_test();
+void around_test();
+void madvise_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -17,6 +22,11 @@ main(int argc, char *argv[])
 {
   mmap_test();
   fork_test();
+  range_test();
+  coherence_test();
+  msync_test();
+  around_test();
+  madvise_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -302,3 +312,336 @@ fork_test(void)
 
   printf("fork_test OK\n");
 }
+
+#define RANGE_PAGES 64
+
+//
+// check that page i of a mapping of the range_test file,
+// which starts at page first, holds its page number.
+//
+void
+_vrange(char *p, int first, int npages)
+{
+  for (int i = 0; i < npages; i++) {
+    if (p[i*PGSIZE] != first + i || p[i*PGSIZE + PGSIZE-1] != first + i) {
+      printf("mismatch in page %d\n", i);
+      err("range mismatch");
+    }
+  }
+}
+
+//
+// map a file larger than a handful of pages, from an offset,
+// and unmap a hole in the middle of a mapping.
+//
+void
+range_test(void)
+{
+  int fd, pid, status;
+  const char * const f = "mmap.range";
+
+  printf("range_test starting\n");
+  testname = "range_test";
+
+  unlink(f);
+  if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+    err("open");
+  for (int i = 0; i < RANGE_PAGES; i++) {
+    memset(buf, i, BSIZE);
+    for (int j = 0; j < PGSIZE/BSIZE; j++)
+      if (write(fd, buf, BSIZE) != BSIZE)
+        err("write");
+  }
+
+  char *p = mmap(0, PGSIZE*RANGE_PAGES, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap whole file");
+  char *q = mmap(0, PGSIZE*5, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, PGSIZE*10);
+  if (q == MAP_FAILED)
+    err("mmap at an offset");
+  if (close(fd) == -1)
+    err("close");
+  _vrange(p, 0, RANGE_PAGES);
+  _vrange(q, 10, 5);
+
+  // punch a hole; both ends must stay mapped.
+  if (munmap(p + PGSIZE*20, PGSIZE*8) == -1)
+    err("munmap hole");
+  _vrange(p, 0, 20);
+  _vrange(p + PGSIZE*28, 28, RANGE_PAGES - 28);
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    _vrange(p + PGSIZE*28, 28, RANGE_PAGES - 28);
+    _vrange(q, 10, 5);
+    // the hole must fault.
+    p[PGSIZE*20] = 0;
+    exit(0);
+  }
+  wait(&status);
+  if (status != -1)
+    err("access to an unmapped hole did not fault");
+
+  if (munmap(p, PGSIZE*RANGE_PAGES) == -1 || munmap(q, PGSIZE*5) == -1)
+    err("munmap");
+  unlink(f);
+
+  printf("range_test OK\n");
+}
+
+//
+// shared mappings of a file, and read() and write() on it,
+// all see the same data, without munmap() in between.
+//
+void
+coherence_test(void)
+{
+  int fd, pid, status;
+  const char * const f = "mmap.coherent";
+  char b;
+
+  printf("coherence_test starting\n");
+  testname = "coherence_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p1 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char *p2 = mmap(0, PGSIZE*2, PROT_READ, MAP_SHARED, fd, 0);
+  if (p1 == MAP_FAILED || p2 == MAP_FAILED)
+    err("mmap");
+  _v1(p2);
+
+  // one mapping sees the other's writes.
+  p1[10] = 'B';
+  if (p2[10] != 'B')
+    err("second mapping does not see write");
+
+  // read() sees a mapping's writes.
+  if (read(fd, buf, 11) != 11 || buf[10] != 'B')
+    err("read() does not see write to mapping");
+
+  // a mapping sees write()s.
+  b = 'C';
+  if (write(fd, &b, 1) != 1)
+    err("write");
+  if (p2[11] != 'C')
+    err("mapping does not see write()");
+
+  // so does a child's mapping, and the other way round.
+  if ((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    if (p2[11] != 'C')
+      exit(1);
+    p1[12] = 'D';
+    exit(0);
+  }
+  wait(&status);
+  if (status != 0)
+    err("child does not see write()");
+  if (p2[12] != 'D')
+    err("parent does not see child's write");
+
+  if (munmap(p1, PGSIZE*2) == -1 || munmap(p2, PGSIZE*2) == -1)
+    err("munmap");
+  if (close(fd) == -1)
+    err("close");
+
+  // written back, and the rest of the file is as it was.
+  if ((fd = open(f, O_RDONLY)) == -1)
+    err("open (2)");
+  if (read(fd, buf, 16) != 16)
+    err("read (2)");
+  if (buf[10] != 'B' || buf[11] != 'C' || buf[12] != 'D' || buf[13] != 'A')
+    err("file does not hold the writes");
+  close(fd);
+  unlink(f);
+
+  printf("coherence_test OK\n");
+}
+
+//
+// msync() writes a shared mapping back without unmapping it,
+// and only accepts ranges that are mapped.
+//
+void
+msync_test(void)
+{
+  int fd;
+  const char * const f = "mmap.sync";
+
+  printf("msync_test starting\n");
+  testname = "msync_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  if (close(fd) == -1)
+    err("close");
+
+  // a clean mapping has nothing to write back.
+  _v1(p);
+  if (msync(p, PGSIZE*2, MS_SYNC) == -1)
+    err("msync of clean pages");
+
+  p[PGSIZE + 5] = 'S';
+  if (msync(p + PGSIZE, PGSIZE, MS_SYNC) == -1)
+    err("msync");
+  p[PGSIZE + 6] = 'T';
+  if (msync(p, PGSIZE*2, MS_ASYNC) == -1)
+    err("msync (2)");
+
+  if (msync(p, PGSIZE*3, MS_SYNC) != -1)
+    err("msync past the end of the mapping succeeded");
+  if (msync(p + 1, PGSIZE, MS_SYNC) != -1)
+    err("msync of an unaligned address succeeded");
+  if (msync(p, PGSIZE, MS_SYNC|MS_ASYNC) != -1)
+    err("msync with MS_SYNC|MS_ASYNC succeeded");
+
+  if (munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+
+  if ((fd = open(f, O_RDONLY)) == -1)
+    err("open (2)");
+  for (int i = 0; i < PGSIZE + 8; i++) {
+    char b;
+    if (read(fd, &b, 1) != 1)
+      err("read");
+    if (b != (i == PGSIZE + 5 ? 'S' : i == PGSIZE + 6 ? 'T' : 'A'))
+      err("file does not hold the synced writes");
+  }
+  close(fd);
+  unlink(f);
+
+  printf("msync_test OK\n");
+}
+
+// the value of a line of the statistics device, or -1.
+int
+statvalue(char *name)
+{
+  static char sbuf[1024];
+  int n = strlen(name), len;
+
+  if ((len = statistics(sbuf, sizeof(sbuf) - 1)) <= 0)
+    return -1;
+  sbuf[len] = 0;
+  for (char *s = sbuf; *s; s++) {
+    if (memcmp(s, name, n) == 0 && s[n] == ':')
+      return atoi(s + n + 2);
+  }
+  return -1;
+}
+
+//
+// a fault on a file mapping also maps the neighbouring pages
+// that are in the page cache already, so going through the
+// file a second time takes only a few faults.
+//
+void
+around_test(void)
+{
+  int fd, npages = 48;
+  const char * const f = "mmap.around";
+
+  printf("around_test starting\n");
+  testname = "around_test";
+
+  unlink(f);
+  if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+    err("open");
+  for (int i = 0; i < npages * (PGSIZE/BSIZE); i++) {
+    memset(buf, 'a' + i / (PGSIZE/BSIZE) % 26, BSIZE);
+    if (write(fd, buf, BSIZE) != BSIZE)
+      err("write");
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    int avoided = statvalue("faults avoided");
+    if (avoided < 0)
+      err("no mapped file statistics");
+    char *p = mmap(0, npages*PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      err("mmap");
+    for (int i = 0; i < npages; i++) {
+      if (p[i*PGSIZE] != 'a' + i % 26 || p[i*PGSIZE + PGSIZE-1] != 'a' + i % 26)
+        err("wrong contents");
+    }
+    if (munmap(p, npages*PGSIZE) == -1)
+      err("munmap");
+    // the whole file is cached after the first pass
+    if (pass == 1 && statvalue("faults avoided") - avoided < npages - npages/8)
+      err("faults were not avoided");
+  }
+  close(fd);
+  unlink(f);
+
+  printf("around_test OK\n");
+}
+
+//
+// madvise() frees heap pages, which read as zeros after,
+// writes back shared mappings before it frees their pages,
+// and refuses ranges that are not mapped.
+//
+void
+madvise_test(void)
+{
+  int fd;
+  const char * const f = "mmap.advise";
+
+  printf("madvise_test starting\n");
+  testname = "madvise_test";
+
+  char *h = sbrk(PGSIZE*2);
+  if (h == (char*)-1)
+    err("sbrk");
+  memset(h, 'H', PGSIZE*2);
+  if (madvise(h, PGSIZE, MADV_DONTNEED) == -1)
+    err("madvise heap");
+  if (h[0] != 0 || h[PGSIZE-1] != 0)
+    err("heap not zero after MADV_DONTNEED");
+  if (h[PGSIZE] != 'H')
+    err("MADV_DONTNEED freed too much");
+  if (madvise(h, PGSIZE*2, MADV_WILLNEED) == -1)
+    err("madvise heap willneed");
+  sbrk(-PGSIZE*2);
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  char *p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap");
+  if (close(fd) == -1)
+    err("close");
+  if (madvise(p, PGSIZE*2, MADV_WILLNEED) == -1)
+    err("madvise willneed");
+  if (madvise(p + PGSIZE, PGSIZE, MADV_SEQUENTIAL) == -1)
+    err("madvise sequential");
+  if (madvise(p, PGSIZE*2, MADV_RANDOM) == -1)
+    err("madvise random");
+  p[5] = 'D';
+  if (madvise(p, PGSIZE, MADV_DONTNEED) == -1)
+    err("madvise dontneed");
+  if (p[5] != 'D' || p[6] != 'A')
+    err("shared write lost by MADV_DONTNEED");
+  p[5] = 'A';
+  _v1(p);
+
+  if (madvise(p, PGSIZE*3, MADV_WILLNEED) != -1)
+    err("madvise past the end of the mapping succeeded");
+  if (madvise(p, PGSIZE, 99) != -1)
+    err("madvise with bad advice succeeded");
+
+  if (munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+  unlink(f);
+
+  printf("madvise_test OK\n");
+}
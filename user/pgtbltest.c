@@ -2,16 +2,21 @@
 #include "kernel/fcntl.h"
 #include "kernel/types.h"
 #include "kernel/riscv.h"
+#include "kernel/wsinfo.h"
 #include "user/user.h"
 
 void ugetpid_test();
 void pgaccess_test();
+void pgscan_test();
+void wsinfo_test();
 
 int
 main(int argc, char *argv[])
 {
   ugetpid_test();
   pgaccess_test();
+  pgscan_test();
+  wsinfo_test();
   printf("pgtbltest: all tests succeeded\n");
   exit(0);
 }
@@ -68,3 +73,62 @@ pgaccess_test()
   free(buf);
   printf("pgaccess_test: OK\n");
 }
+
+#define NSCAN 1000   // more pages than pgaccess() can do
+
+void
+pgscan_test()
+{
+  char *buf;
+  static unsigned char abits[(NSCAN+7)/8], dbits[(NSCAN+7)/8];
+  printf("pgscan_test starting\n");
+  testname = "pgscan_test";
+  // one page at a time, so that no megapages are used:
+  // their pages would share bits
+  buf = sbrk(0);
+  for (int i = 0; i < NSCAN; i++) {
+    if (sbrk(PGSIZE) == (char*)-1)
+      err("sbrk failed");
+  }
+  if (pgscan(buf, NSCAN, abits, dbits) < 0)
+    err("pgscan failed");
+  if (buf[PGSIZE * 3] != 0)
+    err("new page not zero");
+  buf[PGSIZE * 700] = 1;
+  if (pgscan(buf, NSCAN, abits, dbits) < 0)
+    err("pgscan failed");
+  for (int i = 0; i < NSCAN; i++) {
+    int a = (abits[i/8] >> (i%8)) & 1;
+    int d = (dbits[i/8] >> (i%8)) & 1;
+    if (a != (i == 3 || i == 700))
+      err("incorrect access bits set");
+    if (d != (i == 700))
+      err("incorrect dirty bits set");
+  }
+  // pages beyond the end of memory are neither
+  if (pgscan(buf + NSCAN * PGSIZE, 8, abits, 0) < 0)
+    err("pgscan of unmapped pages failed");
+  if (abits[0] != 0)
+    err("unmapped pages reported accessed");
+  sbrk(-NSCAN * PGSIZE);
+  printf("pgscan_test: OK\n");
+}
+
+void
+wsinfo_test()
+{
+  struct wsinfo wi;
+  printf("wsinfo_test starting\n");
+  testname = "wsinfo_test";
+  // long enough for the sampler to ask for at least one sample
+  sleep(25);
+  if (wsinfo(getpid(), &wi) < 0)
+    err("wsinfo failed");
+  if (wi.samples == 0)
+    err("no samples taken");
+  if (wi.hot + wi.cold == 0)
+    err("no pages counted");
+  if (wsinfo(-1, &wi) == 0)
+    err("wsinfo of a bad pid succeeded");
+  printf("wsinfo_test: OK\n");
+}
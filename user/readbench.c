@@ -0,0 +1,72 @@
+// Measure read() throughput from a file small enough to stay
+// in the buffer cache, so the time goes into the system call
+// and the copy to user space rather than the disk.
+//
+// usage: readbench [passes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define FILESZ (16 * BSIZE)   // well under NBUF blocks
+#define TICKS_PER_SEC 10      // timer interrupt is about 1/10th second
+
+char buf[FILESZ];
+
+static void
+bench(char *path, int bufsz, int passes)
+{
+  int fd, n, t0, t1;
+  uint64 total = 0;
+
+  t0 = uptime();
+  for(int i = 0; i < passes; i++){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("readbench: cannot open %s\n", path);
+      exit(1);
+    }
+    while((n = read(fd, buf, bufsz)) > 0)
+      total += n;
+    close(fd);
+  }
+  t1 = uptime();
+
+  if(t1 == t0)
+    t1 = t0 + 1;
+  // MB/s with three decimals; printf has no %f
+  uint64 kbps = total * TICKS_PER_SEC / 1024 / (t1 - t0);
+  int frac = (int)(kbps % 1024 * 1000 / 1024);
+  printf("read size %d: %d KB in %d ticks, %d.%s%s%d MB/s\n", bufsz,
+         (int)(total / 1024), t1 - t0, (int)(kbps / 1024),
+         frac < 100 ? "0" : "", frac < 10 ? "0" : "", frac);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *path = "readbench.tmp";
+  int fd, passes = 512;
+
+  if(argc > 1)
+    passes = atoi(argv[1]);
+
+  memset(buf, 'r', sizeof(buf));
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0 ||
+     write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("readbench: cannot create %s\n", path);
+    exit(1);
+  }
+  close(fd);
+
+  // Warm the buffer cache
+  bench(path, BSIZE, 1);
+
+  bench(path, 64, passes);
+  bench(path, BSIZE, passes);
+  bench(path, FILESZ, passes);
+
+  unlink(path);
+  exit(0);
+}
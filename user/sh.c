@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -49,16 +50,79 @@ struct backcmd {
   struct cmd *cmd;
 };
 
-int fork1(void);  // Fork but panics on failure.
 void panic(char*);
+void syntax(char*);
 struct cmd *parsecmd(char*);
-void runcmd(struct cmd*) __attribute__((noreturn));
+void freecmd(struct cmd*);
 
-// Execute cmd.  Never returns.
+int syntaxerr;  // set by syntax() while parsing
+
+// In the shell's file descriptors, replace fd by -1 in fdmap,
+// so programs started with fdmap do not inherit it.
 void
-runcmd(struct cmd *cmd)
+unmapfd(int *fdmap, int fd)
+{
+  for(int i = 0; i < NOFILE; i++)
+    if(fdmap[i] == fd)
+      fdmap[i] = -1;
+}
+
+// Does cmd run a list, whose second half starts only once the
+// first half's programs exit?
+int
+haslist(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return 0;
+  if(cmd->type == LIST)
+    return 1;
+  if(cmd->type == REDIR)
+    return haslist(((struct redircmd*)cmd)->cmd);
+  return 0;
+}
+
+int runcmd(struct cmd*, int*);
+
+// Run one side of a pipe. A side that runs a list is left to
+// a forked copy of the shell, so that the other side starts at
+// once and the list's waits only reap the list's own children.
+// Returns the number of children the caller must wait for.
+int
+runpipeside(struct cmd *cmd, int *fdmap)
 {
-  int p[2];
+  int fd, i, n, pid;
+
+  if(!haslist(cmd))
+    return runcmd(cmd, fdmap);
+  if((pid = fork()) < 0){
+    fprintf(2, "fork failed\n");
+    return 0;
+  }
+  if(pid == 0){
+    // Close what fdmap does not pass on, such as the far end
+    // of the pipe, which would otherwise never see end of file.
+    for(fd = 0; fd < NOFILE; fd++){
+      for(i = 0; i < NOFILE && fdmap[i] != fd; i++)
+        ;
+      if(i == NOFILE)
+        close(fd);
+    }
+    for(n = runcmd(cmd, fdmap); n > 0; n--)
+      wait(0);
+    exit(0);
+  }
+  return 1;
+}
+
+// Start the programs of cmd with spawn(), the shell's file
+// descriptors given to them as fdmap says, instead of forking
+// a copy of the shell for each of them.
+// Returns the number of children the caller must wait for.
+int
+runcmd(struct cmd *cmd, int *fdmap)
+{
+  int p[2], fd, n, pid;
+  int map[NOFILE];
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
@@ -66,7 +130,7 @@ runcmd(struct cmd *cmd)
   struct redircmd *rcmd;
 
   if(cmd == 0)
-    exit(1);
+    return 0;
 
   switch(cmd->type){
   default:
@@ -75,60 +139,66 @@ runcmd(struct cmd *cmd)
   case EXEC:
     ecmd = (struct execcmd*)cmd;
     if(ecmd->argv[0] == 0)
-      exit(1);
-    exec(ecmd->argv[0], ecmd->argv);
-    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
-    break;
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fdmap) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
 
   case REDIR:
     rcmd = (struct redircmd*)cmd;
-    close(rcmd->fd);
-    if(open(rcmd->file, rcmd->mode) < 0){
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
       fprintf(2, "open %s failed\n", rcmd->file);
-      exit(1);
+      return 0;
     }
-    runcmd(rcmd->cmd);
-    break;
+    memmove(map, fdmap, sizeof(map));
+    unmapfd(map, fd);
+    map[rcmd->fd] = fd;
+    n = runcmd(rcmd->cmd, map);
+    close(fd);
+    return n;
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
-    runcmd(lcmd->right);
-    break;
+    for(n = runcmd(lcmd->left, fdmap); n > 0; n--)
+      wait(0);
+    return runcmd(lcmd->right, fdmap);
 
   case PIPE:
     pcmd = (struct pipecmd*)cmd;
-    if(pipe(p) < 0)
-      panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
     }
+    memmove(map, fdmap, sizeof(map));
+    unmapfd(map, p[0]);
+    unmapfd(map, p[1]);
+    map[1] = p[1];
+    n = runpipeside(pcmd->left, map);
+    memmove(map, fdmap, sizeof(map));
+    unmapfd(map, p[0]);
+    unmapfd(map, p[1]);
+    map[0] = p[0];
+    n += runpipeside(pcmd->right, map);
     close(p[0]);
     close(p[1]);
-    wait(0);
-    wait(0);
-    break;
+    return n;
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
-    break;
+    // The child does not wait, so init inherits what it
+    // started, and the shell only waits for the child.
+    if((pid = fork()) < 0){
+      fprintf(2, "fork failed\n");
+      return 0;
+    }
+    if(pid == 0){
+      runcmd(bcmd->cmd, fdmap);
+      exit(0);
+    }
+    return 1;
   }
-  exit(0);
 }
 
 int
@@ -146,7 +216,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n;
+  int fdmap[NOFILE];
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +237,13 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    for(fd = 0; fd < NOFILE; fd++)
+      fdmap[fd] = fd;
+    for(n = runcmd(cmd, fdmap); n > 0; n--)
+      wait(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -179,15 +255,14 @@ panic(char *s)
   exit(1);
 }
 
-int
-fork1(void)
+// Report a parse error. The parser runs in the shell itself,
+// so it must not exit; it stops at the error instead, and
+// parsecmd() returns 0.
+void
+syntax(char *s)
 {
-  int pid;
-
-  pid = fork();
-  if(pid == -1)
-    panic("fork");
-  return pid;
+  fprintf(2, "%s\n", s);
+  syntaxerr = 1;
 }
 
 //PAGEBREAK!
@@ -331,12 +406,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -380,8 +460,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,8 +488,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -429,16 +513,20 @@ parseexec(char **ps, char *es)
 
   argc = 0;
   ret = parseredirs(ret, ps, es);
-  while(!peek(ps, es, "|)&;")){
+  while(!peek(ps, es, "|)&;") && !syntaxerr){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc + 1 >= MAXARGS){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -492,3 +580,42 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a command tree. The shell parses every command line
+// itself, so it must give the memory back.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
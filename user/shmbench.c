@@ -0,0 +1,194 @@
+// Compare moving data from one process to another through a
+// pipe with moving it through a shared memory segment.
+//
+// Both producers fill each chunk before sending it, and both
+// consumers read each byte of it, so the difference is what
+// the pipe's copies into and out of the kernel cost.
+//
+// usage: shmbench [MB]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define CHUNK  PGSIZE
+#define NCHUNK 15             // ring slots, after the header page
+#define TICKS_PER_SEC 10      // timer interrupt is about 1/10th second
+
+// The first page of the segment; the ring follows it.
+struct ring {
+  volatile uint64 head;   // chunks produced
+  volatile uint64 tail;   // chunks consumed
+};
+
+char buf[CHUNK];
+
+static void
+fill(char *p, uint64 n)
+{
+  uint64 *w = (uint64*)p;
+  for(int i = 0; i < CHUNK / sizeof(uint64); i++)
+    w[i] = n + i;
+}
+
+static uint64
+sum(char *p)
+{
+  uint64 *w = (uint64*)p, s = 0;
+  for(int i = 0; i < CHUNK / sizeof(uint64); i++)
+    s += w[i];
+  return s;
+}
+
+// The sum the consumer should see for nchunks chunks.
+static uint64
+expect(int nchunks)
+{
+  uint64 s = 0;
+  for(int n = 0; n < nchunks; n++){
+    fill(buf, n);
+    s += sum(buf);
+  }
+  return s;
+}
+
+static void
+report(char *how, int nchunks, int t0, int t1)
+{
+  uint64 kb = (uint64)nchunks * CHUNK / 1024;
+
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("%s: %d KB in %d ticks, %d KB/s\n", how, (int)kb, t1 - t0,
+         (int)(kb * TICKS_PER_SEC / (t1 - t0)));
+}
+
+static void
+pipebench(int nchunks, uint64 want)
+{
+  int fds[2], t0, t1, n, xstatus;
+
+  if(pipe(fds) < 0){
+    printf("shmbench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  if(fork() == 0){
+    uint64 s = 0;
+    close(fds[1]);
+    for(int i = 0; i < nchunks; i++){
+      for(int got = 0; got < CHUNK; got += n){
+        if((n = read(fds[0], buf + got, CHUNK - got)) <= 0)
+          exit(1);
+      }
+      s += sum(buf);
+    }
+    exit(s == want ? 0 : 1);
+  }
+  close(fds[0]);
+  for(int i = 0; i < nchunks; i++){
+    fill(buf, i);
+    if(write(fds[1], buf, CHUNK) != CHUNK){
+      printf("shmbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  wait(&xstatus);
+  t1 = uptime();
+
+  if(xstatus != 0){
+    printf("shmbench: pipe consumer saw wrong data\n");
+    exit(1);
+  }
+  report("pipe", nchunks, t0, t1);
+}
+
+static void
+shmbench(int nchunks, uint64 want)
+{
+  int id, t0, t1, xstatus;
+  struct ring *r;
+  char *data;
+
+  if((id = shmget(0, (NCHUNK + 1) * CHUNK)) < 0 ||
+     (r = shmat(id)) == (struct ring*)-1){
+    printf("shmbench: cannot make a segment\n");
+    exit(1);
+  }
+  data = (char*)r + CHUNK;
+  r->head = r->tail = 0;
+
+  t0 = uptime();
+  // the child is attached too, from fork()
+  if(fork() == 0){
+    uint64 s = 0;
+    for(int i = 0; i < nchunks; i++){
+      while(r->head == r->tail)
+        ;
+      __sync_synchronize();
+      s += sum(data + (r->tail % NCHUNK) * CHUNK);
+      __sync_synchronize();
+      r->tail++;
+    }
+    exit(s == want ? 0 : 1);
+  }
+  for(int i = 0; i < nchunks; i++){
+    while(r->head - r->tail == NCHUNK)
+      ;
+    __sync_synchronize();
+    fill(data + (r->head % NCHUNK) * CHUNK, i);
+    __sync_synchronize();
+    r->head++;
+  }
+  wait(&xstatus);
+  t1 = uptime();
+
+  if(xstatus != 0){
+    printf("shmbench: shm consumer saw wrong data\n");
+    exit(1);
+  }
+  report("shm", nchunks, t0, t1);
+  shmdt(r);
+}
+
+// Segments created but never attached must go away when their
+// creator exits, or the second round runs out of segments.
+static void
+reusecheck(void)
+{
+  int xstatus;
+
+  for(int round = 0; round < 2; round++){
+    if(fork() == 0){
+      for(int i = 0; i < NSHM; i++)
+        if(shmget(0, PGSIZE) < 0)
+          exit(1);
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("shmbench: unattached segments were not freed\n");
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 16, nchunks;
+  uint64 want;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  nchunks = mb * 1024 * 1024 / CHUNK;
+  want = expect(nchunks);
+
+  reusecheck();
+  pipebench(nchunks, want);
+  shmbench(nchunks, want);
+  exit(0);
+}
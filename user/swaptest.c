@@ -0,0 +1,73 @@
+//
+// test swap: use more memory than the machine has, and
+// check that every page keeps what was written to it.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES (144 * 256)   // 144 MiB, more than the 128 MiB of RAM
+
+void
+swaptest(int pass)
+{
+  char *base, *p;
+
+  printf("swap pass %d: ", pass);
+
+  // one page at a time, so every page is a small one
+  base = sbrk(0);
+  for(int i = 0; i < NPAGES; i++){
+    if((p = sbrk(PGSIZE)) == (char*)-1){
+      printf("sbrk failed after %d pages\n", i);
+      exit(-1);
+    }
+    *(int*)p = i;
+    *(int*)(p + PGSIZE - sizeof(int)) = ~i;
+  }
+
+  for(int i = 0; i < NPAGES; i++){
+    p = base + (uint64)i * PGSIZE;
+    if(*(int*)p != i || *(int*)(p + PGSIZE - sizeof(int)) != ~i){
+      printf("page %d lost its contents\n", i);
+      exit(-1);
+    }
+  }
+
+  // pipes copy from swapped-out pages with a lock held
+  int fds[2], x;
+  if(pipe(fds) < 0){
+    printf("pipe failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < NPAGES; i += NPAGES / 16){
+    p = base + (uint64)i * PGSIZE;
+    if(write(fds[1], p, sizeof(int)) != sizeof(int) ||
+       read(fds[0], &x, sizeof(int)) != sizeof(int) || x != i){
+      printf("pipe copy of page %d failed\n", i);
+      exit(-1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(sbrk(-NPAGES * PGSIZE) == (char*)-1){
+    printf("sbrk(-%d) failed\n", NPAGES * PGSIZE);
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  swaptest(1);
+
+  // check that the first pass gave back its swap slots.
+  swaptest(2);
+
+  printf("ALL SWAP TESTS PASSED\n");
+  exit(0);
+}
@@ -1,4 +1,5 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/sysinfo.h"
 #include "user/user.h"
@@ -75,6 +76,23 @@ testmem() {
   }
 }
 
+void
+testpart() {
+  struct sysinfo info;
+  uint64 n = 0;
+
+  sinfo(&info);
+  for (int i = 0; i < NCPU; i++)
+    n += info.kmemfree[i] * PGSIZE;
+
+  // The partitions hold part of the free memory; the rest is
+  // in the buddy allocator and the zeroed page pool
+  if (n == 0 || n > info.freemem) {
+    printf("FAIL: kmem partitions hold %d bytes, free mem %d\n", n, info.freemem);
+    exit(1);
+  }
+}
+
 void
 testcall() {
   struct sysinfo info;
@@ -147,6 +165,7 @@ main(int argc, char *argv[])
   printf("sysinfotest: start\n");
   testcall();
   testmem();
+  testpart();
   testproc();
   printf("sysinfotest: OK\n");
   exit(0);
@@ -2,6 +2,9 @@ struct stat;
 #ifdef LAB_SYSCALL
 struct sysinfo;
 #endif
+#ifdef LAB_PGTBL
+struct wsinfo;
+#endif
 #ifdef LAB_MMAP
 typedef unsigned long size_t;
 typedef long int off_t;
@@ -30,12 +33,18 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int spawn(const char*, char**, int*);
+int shmget(int key, int size);
+void* shmat(int id);
+int shmdt(void *addr);
 #ifdef LAB_SYSCALL
 int trace(int);
 int sysinfo(struct sysinfo *);
 #endif
 #ifdef LAB_PGTBL
 int pgaccess(void *base, int len, void *mask);
+int pgscan(void *base, int npages, void *abits, void *dbits);
+int wsinfo(int pid, struct wsinfo *);
 int ugetpid(void);
 #endif
 #ifdef LAB_TRAPS
@@ -52,6 +61,8 @@ int symlink(char* target, char* path);
 void *mmap(void *addr, size_t length, int prot, int flags,
            int fd, off_t offset);
 int munmap(void *addr, size_t length);
+int msync(void *addr, size_t length, int flags);
+int madvise(void *addr, size_t length, int advice);
 #endif
 
 // ulib.c
@@ -70,6 +81,6 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
-#ifdef LAB_LOCK
+#if defined(LAB_LOCK) || defined(LAB_COW) || defined(LAB_MMAP)
 int statistics(void*, int);
 #endif
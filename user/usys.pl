@@ -35,12 +35,20 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("spawn");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
 entry("trace");
 entry("sysinfo");
 entry("connect");
 entry("pgaccess");
+entry("pgscan");
+entry("wsinfo");
 entry("sigalarm");
 entry("sigreturn");
 entry("symlink");
 entry("mmap");
-entry("munmap");
\ No newline at end of file
+entry("munmap");
+entry("msync");
+entry("madvise");
\ No newline at end of file
@@ -44,8 +44,10 @@ main(int argc, char *argv[]) {
             }
         }
 
-        if (fork() == 0) {
-            exec(argv[1], new_args);
+        new_args[i] = 0;
+
+        if (spawn(argv[1], new_args, 0) < 0) {
+            fprintf(2, "xargs: cannot run %s\n", argv[1]);
         } else {
             wait(0);
         }